@@ -26,6 +26,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <util/delay.h>
 #include <avr/pgmspace.h>
 #include <avr/wdt.h>
@@ -35,7 +36,18 @@
 #include "usart.h"
 #include "onewire.h"
 #include "ds18x20.h"
+#include "iopins.h"
+#include "ow_parallel.h"
+#include "ds2482.h"
 #include "i2c.h"
+#include "i2ctemp.h"
+#include "modbus.h"
+
+#ifdef _OW_DS2482_800_
+#define config_channel(channels, i) ds2482_select_channel(channels[i])
+#else
+#define config_channel(channels, i)
+#endif /* _OW_DS2482_800_ */
 
 #define CMD_NONE              0x00
 #define CMD_READLINE          0x01
@@ -66,6 +78,13 @@
 
 #define CMD_MAX_LINE          64
 #define CMD_MAX_HISTORY       4
+#define CMD_PENDING           -2    /* line_input() mid line */
+
+/* 'show' and 'help' go out a part at a time, each no longer than this */
+#define LIST_CHUNK            192
+#define LIST_NONE             0
+#define LIST_SHOW             1
+#define LIST_HELP             2
 
 #define PARAM_I16_1DP_TEMP    0
 #define PARAM_U16             1
@@ -76,27 +95,56 @@
 #define PARAM_U8_TCNT         6
 #define PARAM_U8_FCNT         7
 #define PARAM_DESC            8
+#define PARAM_U8_RES          9
+#define PARAM_U8_MODE         10
+#define PARAM_U16_1DP_GAIN    11
+#define PARAM_U8_MBADDR       12
 
 static inline int8_t configuration_prompt_handler(char *message, sys_config_t *config);
 static int8_t get_line(char *str, int8_t max, uint8_t *ignore_lf);
+static int8_t line_input(char *str, int8_t max, uint8_t *ignore_lf, unsigned char c);
+static void line_history(char *str);
+static int8_t run_command(char *cmdbuf, sys_config_t *config);
 static uint8_t parse_param(void *param, uint8_t type, char *arg);
 static void save_configuration(sys_config_t *config);
 static void default_configuration(sys_config_t *config);
 static void do_readtemp(void);
 static int8_t parse_owid(uint8_t *param, char *arg);
+static int8_t parse_baud(uint32_t *param, char *arg);
+static int8_t parse_curve(uint8_t *points, int16_t *temps, uint8_t *duties, char *arg);
+static void print_curve(const char *name, uint8_t points, int16_t *temps, uint8_t *duties);
+static void print_owid(const char *name, uint8_t *addr);
+static bool do_show(sys_config_t *config, uint8_t part);
+static bool do_help(uint8_t part);
+static void list_start(uint8_t list);
+static bool list_next(sys_config_t *config);
+static void default_curve(uint8_t *points, int16_t *temps, uint8_t *duties);
 static void do_authcheck(void);
+static bool sensors_in_use(void);
 
 uint8_t _g_max_history;
 uint8_t _g_show_history;
 uint8_t _g_next_history;
 char _g_cmd_history[CMD_MAX_HISTORY][CMD_MAX_LINE];
 
+/* Shared by the boot prompt and the runtime shell */
+static char _g_cmdbuf[CMD_MAX_LINE];
+static uint8_t _g_ignore_lf;
+static uint8_t _g_line_state;
+static int8_t _g_line_count;
+static bool _g_shell_open;
+static bool _g_stored;          /* A command has stored a setting */
+static uint8_t _g_list;
+static uint8_t _g_list_part;
+
+/* Default curve, equivalent to the default linear ramp */
+static const int16_t _g_def_curve_temp[] PROGMEM = { DEF_TEMP_MIN, DEF_TEMP_MAX };
+static const uint8_t _g_def_curve_duty[] PROGMEM = { DEF_PCT_MIN, DEF_PCT_MAX };
+
 void configuration_bootprompt(sys_config_t *config)
 {
-    char cmdbuf[64];
     uint8_t i;
     int8_t enter_bootpromt = 0;
-    uint8_t ignore_lf = 0;
 
     printf("<Press Ctrl+C to enter configuration prompt>\r\n");
 
@@ -107,14 +155,22 @@ void configuration_bootprompt(sys_config_t *config)
             char c = console_get();
             if (c == 3) /* Ctrl + C */
             {
-                enter_bootpromt = 1;
-                break;
+                if (!enter_bootpromt)
+                    enter_bootpromt = 1;
+
+                /* Wait it out. A Modbus request can have a 0x03 in it too */
+                if (!config->modbus_addr)
+                    break;
+            }
+            else if (config->modbus_addr)
+            {
+                enter_bootpromt = -1;
             }
         }
         delay_10ms(1);
     }
 
-    if (!enter_bootpromt)
+    if (enter_bootpromt != 1)
         return;
 
     printf("\r\n");
@@ -124,22 +180,22 @@ void configuration_bootprompt(sys_config_t *config)
         int8_t ret;
 
         printf("config>");
-        ret = get_line(cmdbuf, sizeof(cmdbuf), &ignore_lf);
+        ret = get_line(_g_cmdbuf, sizeof(_g_cmdbuf), &_g_ignore_lf);
 
         if (ret == 0 || ret == -1) {
             printf("\r\n");
             continue;
         }
 
-        ret = configuration_prompt_handler(cmdbuf, config);
-
-        if (ret > 0)
-            printf("Error: command failed\r\n");
+        ret = run_command(_g_cmdbuf, config);
 
         if (ret == -1) {
             return;
         }
 
+        while (list_next(config))
+            wdt_reset();
+
         /* Hack to update PWMs while in the menu.
          * Assists with configuration
          */
@@ -147,147 +203,297 @@ void configuration_bootprompt(sys_config_t *config)
     }
 }
 
+/*
+ * The same prompt at runtime, opened with Ctrl+C. The console task feeds
+ * it a byte at a time, so the fans stay under control while it's open.
+ * Settings read at startup (sensors, Modbus, baud) need a save and reset.
+ */
+void configuration_shell_open(void)
+{
+    _g_shell_open = true;
+    printf("\r\nConfiguration prompt. Sensor, Modbus and baud changes need a save and reset. 'exit' to leave\r\nconfig>");
+}
+
+bool configuration_shell_active(void)
+{
+    return _g_shell_open;
+}
+
+/*
+ * Returns true when a command has stored a setting, so the caller can
+ * pick it up. Looking at settings mustn't upset the running control loop.
+ */
+bool configuration_shell(sys_config_t *config, char c)
+{
+    int8_t ret;
+
+    ret = line_input(_g_cmdbuf, sizeof(_g_cmdbuf), &_g_ignore_lf, c);
+
+    if (ret == CMD_PENDING)
+        return false;
+
+    if (ret == 0 || ret == -1) {
+        printf("\r\nconfig>");
+        return false;
+    }
+
+    line_history(_g_cmdbuf);
+    _g_stored = false;
+    ret = run_command(_g_cmdbuf, config);
+
+    if (ret == -1)
+        _g_shell_open = false;
+    else if (_g_list == LIST_NONE)
+        printf("config>");
+
+    return ret == 0 && _g_stored;
+}
+
+/*
+ * Call every tick. A listing goes out a part at a time, whenever the TX
+ * buffer can take one without waiting. Returns false until it has all
+ * gone, and input should be left in the RX buffer till then.
+ */
+bool configuration_shell_print(sys_config_t *config)
+{
+    if (_g_list == LIST_NONE)
+        return true;
+
+    if (console_tx_free() < LIST_CHUNK || list_next(config))
+        return false;
+
+    printf("config>");
+    return true;
+}
+
+static void list_start(uint8_t list)
+{
+    _g_list = list;
+    _g_list_part = 0;
+}
+
+/* Prints the next part of the listing started by 'show' or 'help'. False once it's done */
+static bool list_next(sys_config_t *config)
+{
+    bool more = false;
+
+    if (_g_list == LIST_SHOW)
+        more = do_show(config, _g_list_part);
+    else if (_g_list == LIST_HELP)
+        more = do_help(_g_list_part);
+
+    _g_list_part++;
+
+    if (!more)
+        _g_list = LIST_NONE;
+
+    return more;
+}
+
+static int8_t run_command(char *cmdbuf, sys_config_t *config)
+{
+    int8_t ret;
+
+    ret = configuration_prompt_handler(cmdbuf, config);
+
+    if (ret > 0)
+        printf("Error: command failed\r\n");
+
+    return ret;
+}
+
 #ifdef _SINGLEZONE_
 
-static void do_show(sys_config_t *config)
+/* One part per call, each no longer than LIST_CHUNK. False once past the end */
+static bool do_show(sys_config_t *config, uint8_t part)
 {
     fixedpoint_sign(config->temp_max, temp_max);
     fixedpoint_sign(config->temp_min, temp_min);
+    fixedpoint_sign(config->temp_setpoint, temp_setpoint);
 
-    printf(
+    switch (part)
+    {
+    case 0:
+        printf(
             "\r\nCurrent configuration:\r\n\r\n"
             "\tnumfans ...........: %u\r\n"
             "\tfansmax ...........: %u\r\n"
             "\tfansmin ...........: %u\r\n"
             "\tfansstart .........: %u\r\n"
             "\tfansminrpm ........: %u\r\n"
+          , config->num_fans,
+            config->fans_max,
+            config->fans_min,
+            config->fans_start,
+            config->fans_minrpm);
+        break;
+    case 1:
+        printf(
+            "\tfansmaxrpm ........: %u\r\n"
             "\tfansminoff ........: %u\r\n"
             "\r\n"
             "\tmintemps ..........: %u\r\n"
             "\ttempmax ...........: %s%u.%u\r\n"
             "\ttempmin ...........: %s%u.%u\r\n"
             "\ttemphyst ..........: %u.%u\r\n"
-            "\ttemp1desc .........: %s\r\n"
-            "\ttemp2desc .........: %s\r\n"
-            "\ttemp3desc .........: %s\r\n"
-            "\ttemp4desc .........: %s\r\n"
-            "\r\n"
-            "\tmanualassignment ..: %u\r\n"
-            "\tsensor1addr .......: %02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X\r\n"
-            "\tsensor2addr .......: %02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X\r\n"
-            "\tsensor3addr .......: %02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X\r\n"
-            "\tsensor4addr .......: %02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X\r\n"
-          , config->num_fans,
-            config->fans_max,
-            config->fans_min,
-            config->fans_start,
-            config->fans_minrpm,
+          , config->fans_maxrpm,
             config->fans_minoff,
             config->min_temps,
             fixedpoint_arg(config->temp_max, temp_max),
             fixedpoint_arg(config->temp_min, temp_min),
-            fixedpoint_arg_u(config->temp_hyst),
+            fixedpoint_arg_u(config->temp_hyst));
+        break;
+    case 2:
+        printf(
+            "\ttempsetpoint ......: %s%u.%u\r\n"
+            "\ttemp1desc .........: %s\r\n"
+            "\ttemp2desc .........: %s\r\n"
+            "\ttemp3desc .........: %s\r\n"
+            "\ttemp4desc .........: %s\r\n"
+          , fixedpoint_arg(config->temp_setpoint, temp_setpoint),
             config->temp1_desc,
             config->temp2_desc,
             config->temp3_desc,
-            config->temp4_desc,
-            config->manual_assignment,
-            config->sensor1_addr[0]
-          , config->sensor1_addr[1],
-            config->sensor1_addr[2],
-            config->sensor1_addr[3],
-            config->sensor1_addr[4],
-            config->sensor1_addr[5],
-            config->sensor1_addr[6],
-            config->sensor1_addr[7]
-          , 0, 0, 0, 0, 0, 0, 0
-          , config->sensor2_addr[0]
-          , config->sensor2_addr[1],
-            config->sensor2_addr[2],
-            config->sensor2_addr[3],
-            config->sensor2_addr[4],
-            config->sensor2_addr[5],
-            config->sensor2_addr[6],
-            config->sensor2_addr[7]
-          , 0, 0, 0, 0, 0, 0, 0
-          , config->sensor3_addr[0]
-          , config->sensor3_addr[1],
-            config->sensor3_addr[2],
-            config->sensor3_addr[3],
-            config->sensor3_addr[4],
-            config->sensor3_addr[5],
-            config->sensor3_addr[6],
-            config->sensor3_addr[7]
-          , 0, 0, 0, 0, 0, 0, 0
-          , config->sensor4_addr[0]
-          , config->sensor4_addr[1],
-            config->sensor4_addr[2],
-            config->sensor4_addr[3],
-            config->sensor4_addr[4],
-            config->sensor4_addr[5],
-            config->sensor4_addr[6],
-            config->sensor4_addr[7]
-          , 0, 0, 0, 0, 0, 0, 0
-        );
-
-    printf("\r\n");
+            config->temp4_desc);
+        break;
+    case 3:
+        printf(
+            "\r\n"
+            "\tctlmode ...........: %u\r\n"
+            "\tpidkp .............: %u.%u\r\n"
+            "\tpidki .............: %u.%u\r\n"
+            "\tpidkd .............: %u.%u\r\n"
+            "\tfanramp ...........: %u\r\n"
+            "\ttelemetry .........: %u\r\n"
+          , config->ctl_mode,
+            fixedpoint_arg_u(config->pid_kp),
+            fixedpoint_arg_u(config->pid_ki),
+            fixedpoint_arg_u(config->pid_kd),
+            config->fan_ramp,
+            config->telemetry);
+        break;
+    case 4:
+        printf(
+            "\tmodbusaddr ........: %u\r\n"
+            "\tbaud ..............: %lu\r\n"
+            "\r\n"
+            "\tsensorres .........: %u\r\n"
+            "\tmanualassignment ..: %u\r\n"
+          , config->modbus_addr,
+            config->console_baud,
+            config->sensor_res,
+            config->manual_assignment);
+        break;
+    case 5:
+        print_owid("sensor1addr .......", config->sensor1_addr);
+        print_owid("sensor2addr .......", config->sensor2_addr);
+        break;
+    case 6:
+        print_owid("sensor3addr .......", config->sensor3_addr);
+        print_owid("sensor4addr .......", config->sensor4_addr);
+        break;
+    case 7:
+        printf("\r\n");
+        print_curve("curve .............", config->curve_points, config->curve_temp, config->curve_duty);
+        printf("\r\n");
+        break;
+    default:
+        return false;
+    }
+
+    return true;
 }
 
-static void do_help(void)
-{
-    printf(
-        "\r\nCommands:\r\n\r\n"
-        "\tshow\r\n"
-        "\t\tShow current configuration\r\n\r\n"
-        "\tdefault\r\n"
-        "\t\tLoad the default configuration\r\n\r\n"
-        "\tsave\r\n"
-        "\t\tSave current configuration\r\n\r\n"
-        "\texit\r\n"
-        "\t\tExit this menu and start\r\n\r\n"
-        "\tnumfans [0 to %u]\r\n"
-        "\t\tSets the number of fans connected\r\n\r\n"
-        "\tfansmax [0 to 100]\r\n"
-        "\t\tSets the maximum duty cycle for fans\r\n\r\n"
-        "\tfansmin [0 to 100]\r\n"
-        "\t\tSets the minimum duty cycle for fans\r\n\r\n"
-        "\tfansstart [0 to 100]\r\n"
-        "\t\tSets the duty cycle to use between reset and first calculation\r\n"
-        "\t\tand when in the configuration prompt\r\n\r\n"
-        "\tfansminrpm [0 to 65535]\r\n"
-        "\t\tSets the stall-restart threshold RPM for all fans\r\n\r\n"
-        "\tfansminoff [0 or 1]\r\n"
-        "\t\tSet to '1' to power off fan below minimum temp\r\n\r\n"
-        "\t\tStall checking is not performed when set to '1'\r\n\r\n"
-        "\tmintemps [0 to 4]\r\n"
-        "\t\tSets the number of expected temperature sensors\r\n\r\n"
-        "\ttempmax [-55.0 to 125.0]\r\n"
-        "\t\tSets the temperature at which fan is set to the maximum\r\n"
-        "\t\tconfigured duty cycle\r\n\r\n"
-        "\ttempmin [-55.0 to 125.0]\r\n"
-        "\t\tSets the temperature threshold at which fan starts to\r\n"
-        "\t\tincrease from the minimum configured duty cycle\r\n\r\n"
-        "\ttemphyst [0 to 180.0]\r\n"
-        "\t\tSets hysteresis when using 'minoff'. The fan will not switch off\r\n"
-        "\t\tuntil current temp is less than temp1min, minus temp1hyst\r\n\r\n"
-        "\ttemp1desc [desc]\r\n"
-        "\ttemp2desc [desc]\r\n"
-        "\ttemp3desc [desc]\r\n"
-        "\ttemp4desc [desc]\r\n"
-        "\t\tSets descriptions (15 chars max)\r\n\r\n"
-        "\treadtemp\r\n"
-        "\t\tProbe and read out all attached sensors\r\n\r\n"
-        "\tauthcheck\r\n"
-        "\t\tCheck authenticity of attached DS18B20 sensors\r\n\r\n"
-        "\tmanualassignment [0 or 1]\r\n"
-        "\t\tSet to '1' to enable manual assignment of sensor address-to-index\r\n\r\n"
-        "\tsensor1addr [addr or 'none']\r\n"
-        "\tsensor2addr [addr or 'none']\r\n"
-        "\tsensor3addr [addr or 'none']\r\n"
-        "\tsensor4addr [addr or 'none']\r\n"
-        "\t\tSets addresses of sensors\r\n\r\n"
-    , MAX_FANS);
-}
+static const char _g_help[] PROGMEM =
+    "\r\nCommands:\r\n\r\n"
+    "\tshow\r\n"
+    "\t\tShow current configuration\r\n\r\n"
+    "\tdefault\r\n"
+    "\t\tLoad the default configuration\r\n\r\n"
+    "\tsave\r\n"
+    "\t\tSave current configuration\r\n\r\n"
+    "\texit\r\n"
+    "\t\tExit this menu and start\r\n\r\n"
+    "\tnumfans [0 to " stringify(MAX_FANS) "]\r\n"
+    "\t\tSets the number of fans connected\r\n\r\n"
+    "\tfansmax [0 to 100]\r\n"
+    "\t\tSets the maximum duty cycle for fans\r\n\r\n"
+    "\tfansmin [0 to 100]\r\n"
+    "\t\tSets the minimum duty cycle for fans\r\n\r\n"
+    "\tfansstart [0 to 100]\r\n"
+    "\t\tSets the duty cycle to use between reset and first calculation\r\n"
+    "\t\tand when in the configuration prompt\r\n\r\n"
+    "\tfansminrpm [0 to 65535]\r\n"
+    "\t\tSets the stall-restart threshold RPM for all fans\r\n"
+    "\t\tTrue RPM. Versions before period timing showed twice this,\r\n"
+    "\t\tso halve a threshold carried over from one\r\n\r\n"
+    "\tfansmaxrpm [0 to 65535]\r\n"
+    "\t\tSet to the full speed of the fans to control RPM instead of duty\r\n"
+    "\t\tcycle. fansmin/fansmax then set a percentage of this speed and\r\n"
+    "\t\tthe duty of each fan is adjusted to hold it. '0' to disable\r\n\r\n"
+    "\tfansminoff [0 or 1]\r\n"
+    "\t\tSet to '1' to power off fan below minimum temp\r\n\r\n"
+    "\t\tStall checking is not performed when set to '1'\r\n\r\n"
+    "\tmintemps [0 to 4]\r\n"
+    "\t\tSets the number of expected temperature sensors\r\n\r\n"
+    "\ttempmax [-55.0 to 125.0]\r\n"
+    "\t\tSets the temperature at which fan is set to the maximum\r\n"
+    "\t\tconfigured duty cycle\r\n\r\n"
+    "\ttempmin [-55.0 to 125.0]\r\n"
+    "\t\tSets the temperature threshold at which fan starts to\r\n"
+    "\t\tincrease from the minimum configured duty cycle\r\n\r\n"
+    "\ttemphyst [0 to 180.0]\r\n"
+    "\t\tSets hysteresis when using 'minoff'. The fan will not switch off\r\n"
+    "\t\tuntil current temp is less than temp1min, minus temp1hyst\r\n\r\n"
+    "\ttempsetpoint [-55.0 to 125.0]\r\n"
+    "\t\tSets the temperature to hold when ctlmode is '1'\r\n\r\n"
+    "\tcurve [temp:duty ... or 'none']\r\n"
+    "\t\tSets the fan curve used when ctlmode is '2'. 2 to " stringify(CURVE_MAX_POINTS) " points in\r\n"
+    "\t\tascending temperature order, e.g. 'curve 35.0:20 45.0:100'\r\n\r\n"
+    "\tctlmode [0 to 2]\r\n"
+    "\t\tSelects how duty is calculated from temperature. '0' ramps\r\n"
+    "\t\tlinearly between tempmin and tempmax. '1' uses a PID loop to hold\r\n"
+    "\t\ttempsetpoint. '2' follows 'curve'. All are limited to the fan\r\n"
+    "\t\tmin/max duty.\r\n"
+    "\t\tSwitching off below the minimum temp still applies\r\n\r\n"
+    "\tpidkp [0 to 100.0]\r\n"
+    "\t\tProportional gain. Percent duty per degree above setpoint\r\n\r\n"
+    "\tpidki [0 to 100.0]\r\n"
+    "\t\tIntegral gain. Percent duty per degree above setpoint, per second\r\n\r\n"
+    "\tpidkd [0 to 100.0]\r\n"
+    "\t\tDerivative gain. Percent duty per degree per second of rise\r\n\r\n"
+    "\tfanramp [0 to 100]\r\n"
+    "\t\tLimits how fast fan duty changes, in percent per second.\r\n"
+    "\t\t'0' applies changes immediately\r\n\r\n"
+    "\ttelemetry [0 or 1]\r\n"
+    "\t\tSet to '1' to send status as binary frames instead of text.\r\n"
+    "\t\tSee tools/telemetry.py\r\n\r\n"
+    "\tmodbusaddr [0 to 247]\r\n"
+    "\t\tSet to answer Modbus RTU requests at this slave address instead\r\n"
+    "\t\tof printing status. '0' to disable. See modbus.h for registers\r\n\r\n"
+    "\tbaud [9600 to 153600]\r\n"
+    "\t\tConsole baud rate once this prompt has been and gone. Startup and\r\n"
+    "\t\tthis prompt are always at " stringify(UART_BAUD) ". 9600, 19200, 38400, 57600,\r\n"
+    "\t\t76800 or 153600 with the 12.288MHz crystal\r\n\r\n"
+    "\ttemp1desc [desc]\r\n"
+    "\ttemp2desc [desc]\r\n"
+    "\ttemp3desc [desc]\r\n"
+    "\ttemp4desc [desc]\r\n"
+    "\t\tSets descriptions (15 chars max)\r\n\r\n"
+    "\tsensorres [9 to 12]\r\n"
+    "\t\tSets the DS18B20 resolution in bits. Lower resolutions convert\r\n"
+    "\t\tfaster (94, 188, 375 or 750ms). Applied to the sensors at startup\r\n\r\n"
+    "\treadtemp\r\n"
+    "\t\tProbe and read out all attached sensors\r\n\r\n"
+    "\tauthcheck\r\n"
+    "\t\tCheck authenticity of attached DS18B20 sensors\r\n\r\n"
+    "\tmanualassignment [0 or 1]\r\n"
+    "\t\tSet to '1' to enable manual assignment of sensor address-to-index\r\n\r\n"
+    "\tsensor1addr [addr or 'none']\r\n"
+    "\tsensor2addr [addr or 'none']\r\n"
+    "\tsensor3addr [addr or 'none']\r\n"
+    "\tsensor4addr [addr or 'none']\r\n"
+    "\t\tSets addresses of sensors\r\n\r\n";
 
 static inline int8_t configuration_prompt_handler(char *text, sys_config_t *config)
 {
@@ -312,6 +518,9 @@ static inline int8_t configuration_prompt_handler(char *text, sys_config_t *conf
     else if (!stricmp(command, "fansminrpm")) {
         return parse_param(&config->fans_minrpm, PARAM_U16, arg);
     }
+    else if (!stricmp(command, "fansmaxrpm")) {
+        return parse_param(&config->fans_maxrpm, PARAM_U16, arg);
+    }
     else if (!stricmp(command, "mintemps")) {
         return parse_param(&config->min_temps, PARAM_U8_TCNT, arg);
     }
@@ -324,6 +533,12 @@ static inline int8_t configuration_prompt_handler(char *text, sys_config_t *conf
     else if (!stricmp(command, "temphyst")) {
         return parse_param(&config->temp_hyst, PARAM_U16_1DP_TEMPMAX, arg);
     }
+    else if (!stricmp(command, "tempsetpoint")) {
+        return parse_param(&config->temp_setpoint, PARAM_I16_1DP_TEMP, arg);
+    }
+    else if (!stricmp(command, "curve")) {
+        return parse_curve(&config->curve_points, config->curve_temp, config->curve_duty, arg);
+    }
     else if (!stricmp(command, "fansminoff")) {
         return parse_param(&config->fans_minoff, PARAM_U8_BIT, arg);
     }
@@ -333,6 +548,33 @@ static inline int8_t configuration_prompt_handler(char *text, sys_config_t *conf
     else if (!stricmp(command, "temp2desc")) {
         return parse_param(config->temp2_desc, PARAM_DESC, arg);
     }
+    else if (!stricmp(command, "ctlmode")) {
+        return parse_param(&config->ctl_mode, PARAM_U8_MODE, arg);
+    }
+    else if (!stricmp(command, "pidkp")) {
+        return parse_param(&config->pid_kp, PARAM_U16_1DP_GAIN, arg);
+    }
+    else if (!stricmp(command, "pidki")) {
+        return parse_param(&config->pid_ki, PARAM_U16_1DP_GAIN, arg);
+    }
+    else if (!stricmp(command, "pidkd")) {
+        return parse_param(&config->pid_kd, PARAM_U16_1DP_GAIN, arg);
+    }
+    else if (!stricmp(command, "fanramp")) {
+        return parse_param(&config->fan_ramp, PARAM_U8_PCT, arg);
+    }
+    else if (!stricmp(command, "telemetry")) {
+        return parse_param(&config->telemetry, PARAM_U8_BIT, arg);
+    }
+    else if (!stricmp(command, "modbusaddr")) {
+        return parse_param(&config->modbus_addr, PARAM_U8_MBADDR, arg);
+    }
+    else if (!stricmp(command, "baud")) {
+        return parse_baud(&config->console_baud, arg);
+    }
+    else if (!stricmp(command, "sensorres")) {
+        return parse_param(&config->sensor_res, PARAM_U8_RES, arg);
+    }
     else if (!stricmp(command, "manualassignment")) {
         return parse_param(&config->manual_assignment, PARAM_U8_BIT, arg);
     }
@@ -355,24 +597,32 @@ static inline int8_t configuration_prompt_handler(char *text, sys_config_t *conf
     }
     else if (!stricmp(command, "default")) {
         default_configuration(config);
+        _g_stored = true;
         printf("\r\nDefault configuration loaded.\r\n\r\n");
         return 0;
     }
     else if (!stricmp(command, "exit")) {
-        printf("\r\nStarting...\r\n");
+        if (_g_shell_open)
+            printf("\r\nBack to status output\r\n");
+        else
+            printf("\r\nStarting...\r\n");
         return -1;
     }
     else if (!stricmp(command, "readtemp")) {
+        if (sensors_in_use())
+            return 1;
         do_readtemp();
     }
     else if (!stricmp(command, "authcheck")) {
+        if (sensors_in_use())
+            return 1;
         do_authcheck();
     }
     else if (!stricmp(command, "show")) {
-        do_show(config);
+        list_start(LIST_SHOW);
     }
     else if ((!stricmp(command, "help") || !stricmp(command, "?"))) {
-        do_help();
+        list_start(LIST_HELP);
         return 0;
     }
     else
@@ -392,15 +642,27 @@ static void default_configuration(sys_config_t *config)
     config->fans_min = DEF_PCT_MIN;
     config->fans_start = DEF_PCT_MIN;
     config->fans_minrpm = DEF_MIN_RPM;
+    config->fans_maxrpm = DEF_MAX_RPM;
     config->temp_min = DEF_TEMP_MIN;
     config->temp_max = DEF_TEMP_MAX;
     config->temp_hyst = 0;
+    config->temp_setpoint = DEF_TEMP_SETPOINT;
+    default_curve(&config->curve_points, config->curve_temp, config->curve_duty);
     config->fans_minoff = false;
     config->min_temps = 0;
     config->temp1_desc[0] = 0;
     config->temp2_desc[0] = 0;
     config->temp3_desc[0] = 0;
     config->temp4_desc[0] = 0;
+    config->ctl_mode = CTL_MODE_LINEAR;
+    config->pid_kp = DEF_PID_KP;
+    config->pid_ki = DEF_PID_KI;
+    config->pid_kd = DEF_PID_KD;
+    config->fan_ramp = DEF_FAN_RAMP;
+    config->telemetry = false;
+    config->modbus_addr = 0;
+    config->console_baud = UART_BAUD;
+    config->sensor_res = DEF_SENSOR_RES;
     config->manual_assignment = false;
     memset(config->sensor1_addr, 0x00, OW_ROMCODE_SIZE);
     memset(config->sensor2_addr, 0x00, OW_ROMCODE_SIZE);
@@ -410,20 +672,35 @@ static void default_configuration(sys_config_t *config)
 
 #else /* _SINGLEZONE_ */
 
-static void do_show(sys_config_t *config)
+/* One part per call, each no longer than LIST_CHUNK. False once past the end */
+static bool do_show(sys_config_t *config, uint8_t part)
 {
     fixedpoint_sign(config->temp1_max, temp1_max);
     fixedpoint_sign(config->temp1_min, temp1_min);
 
     fixedpoint_sign(config->temp2_max, temp2_max);
     fixedpoint_sign(config->temp2_min, temp2_min);
+    fixedpoint_sign(config->temp1_setpoint, temp1_setpoint);
+    fixedpoint_sign(config->temp2_setpoint, temp2_setpoint);
 
-    printf(
+    switch (part)
+    {
+    case 0:
+        printf(
             "\r\nCurrent configuration:\r\n\r\n"
             "\tfan1max ...........: %u\r\n"
             "\tfan1min ...........: %u\r\n"
             "\tfan1start .........: %u\r\n"
             "\tfan1minrpm ........: %u\r\n"
+            "\tfan1maxrpm ........: %u\r\n"
+          , config->fan1_max,
+            config->fan1_min,
+            config->fan1_start,
+            config->fan1_minrpm,
+            config->fan1_maxrpm);
+        break;
+    case 1:
+        printf(
             "\tfan1minoff ........: %u\r\n"
             "\r\n"
             "\tfan2enabled .......: %u\r\n"
@@ -431,121 +708,190 @@ static void do_show(sys_config_t *config)
             "\tfan2min ...........: %u\r\n"
             "\tfan2start .........: %u\r\n"
             "\tfan2minrpm ........: %u\r\n"
+          , config->fan1_minoff,
+            config->fan2_enabled,
+            config->fan2_max,
+            config->fan2_min,
+            config->fan2_start,
+            config->fan2_minrpm);
+        break;
+    case 2:
+        printf(
+            "\tfan2maxrpm ........: %u\r\n"
             "\tfan2minoff ........: %u\r\n"
             "\r\n"
             "\ttemp1max ..........: %s%u.%u\r\n"
             "\ttemp1min ..........: %s%u.%u\r\n"
             "\ttemp1hyst .........: %u.%u\r\n"
+          , config->fan2_maxrpm,
+            config->fan2_minoff,
+            fixedpoint_arg(config->temp1_max, temp1_max),
+            fixedpoint_arg(config->temp1_min, temp1_min),
+            fixedpoint_arg_u(config->temp1_hyst));
+        break;
+    case 3:
+        printf(
+            "\ttemp1setpoint .....: %s%u.%u\r\n"
             "\ttemp1desc .........: %s\r\n"
             "\r\n"
             "\ttemp2max ..........: %s%u.%u\r\n"
             "\ttemp2min ..........: %s%u.%u\r\n"
             "\ttemp2hyst .........: %u.%u\r\n"
-            "\ttemp2desc .........: %s\r\n"
-            "\r\n"
-            "\tmanualassignment ..: %u\r\n"
-            "\tsensor1addr .......: %02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X\r\n"
-            "\tsensor2addr .......: %02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X\r\n",
-            config->fan1_max,
-            config->fan1_min,
-            config->fan1_start,
-            config->fan1_minrpm,
-            config->fan1_minoff,
-            config->fan2_enabled,
-            config->fan2_max,
-            config->fan2_min,
-            config->fan2_start,
-            config->fan2_minrpm,
-            config->fan2_minoff,
-            fixedpoint_arg(config->temp1_max, temp1_max),
-            fixedpoint_arg(config->temp1_min, temp1_min),
-            fixedpoint_arg_u(config->temp1_hyst),
+          , fixedpoint_arg(config->temp1_setpoint, temp1_setpoint),
             config->temp1_desc,
             fixedpoint_arg(config->temp2_max, temp2_max),
             fixedpoint_arg(config->temp2_min, temp2_min),
-            fixedpoint_arg_u(config->temp2_hyst),
+            fixedpoint_arg_u(config->temp2_hyst));
+        break;
+    case 4:
+        printf(
+            "\ttemp2setpoint .....: %s%u.%u\r\n"
+            "\ttemp2desc .........: %s\r\n"
+            "\r\n"
+            "\tctlmode ...........: %u\r\n"
+            "\tpidkp .............: %u.%u\r\n"
+            "\tpidki .............: %u.%u\r\n"
+          , fixedpoint_arg(config->temp2_setpoint, temp2_setpoint),
             config->temp2_desc,
-            config->manual_assignment,
-            config->sensor1_addr[0],
-            config->sensor1_addr[1],
-            config->sensor1_addr[2],
-            config->sensor1_addr[3],
-            config->sensor1_addr[4],
-            config->sensor1_addr[5],
-            config->sensor1_addr[6],
-            config->sensor1_addr[7],
-            config->sensor2_addr[0],
-            config->sensor2_addr[1],
-            config->sensor2_addr[2],
-            config->sensor2_addr[3],
-            config->sensor2_addr[4],
-            config->sensor2_addr[5],
-            config->sensor2_addr[6],
-            config->sensor2_addr[7]
-        );
-
-    printf("\r\n");
+            config->ctl_mode,
+            fixedpoint_arg_u(config->pid_kp),
+            fixedpoint_arg_u(config->pid_ki));
+        break;
+    case 5:
+        printf(
+            "\tpidkd .............: %u.%u\r\n"
+            "\tfanramp ...........: %u\r\n"
+            "\ttelemetry .........: %u\r\n"
+            "\tmodbusaddr ........: %u\r\n"
+            "\tbaud ..............: %lu\r\n"
+            "\r\n"
+          , fixedpoint_arg_u(config->pid_kd),
+            config->fan_ramp,
+            config->telemetry,
+            config->modbus_addr,
+            config->console_baud);
+        break;
+    case 6:
+        printf(
+            "\tsensorres .........: %u\r\n"
+            "\tmanualassignment ..: %u\r\n"
+          , config->sensor_res,
+            config->manual_assignment);
+        print_owid("sensor1addr .......", config->sensor1_addr);
+        print_owid("sensor2addr .......", config->sensor2_addr);
+        break;
+    case 7:
+        printf("\r\n");
+        print_curve("curve1 ............", config->curve1_points, config->curve1_temp, config->curve1_duty);
+        break;
+    case 8:
+        print_curve("curve2 ............", config->curve2_points, config->curve2_temp, config->curve2_duty);
+        printf("\r\n");
+        break;
+    default:
+        return false;
+    }
+
+    return true;
 }
 
-static void do_help(void)
-{
-    printf(
-        "\r\nCommands:\r\n\r\n"
-        "\tshow\r\n"
-        "\t\tShow current configuration\r\n\r\n"
-        "\tdefault\r\n"
-        "\t\tLoad the default configuration\r\n\r\n"
-        "\tsave\r\n"
-        "\t\tSave current configuration\r\n\r\n"
-        "\texit\r\n"
-        "\t\tExit this menu and start\r\n\r\n"
-        "\tfan1max [0 to 100]\r\n"
-        "\tfan2max [0 to 100]\r\n"
-        "\t\tSets the maximum duty cycle for fan\r\n\r\n"
-        "\tfan1min [0 to 100]\r\n"
-        "\tfan2min [0 to 100]\r\n"
-        "\t\tSets the minimum duty cycle for fan\r\n\r\n"
-        "\tfan1start [0 to 100]\r\n"
-        "\tfan2start [0 to 100]\r\n"
-        "\t\tSets the duty cycle to use between reset and first calculation\r\n"
-        "\t\tand when in the configuration prompt\r\n\r\n"
-        "\tfan1minrpm [0 to 65535]\r\n"
-        "\tfan2minrpm [0 to 65535]\r\n"
-        "\t\tSets the stall-restart threshold RPM for fan\r\n\r\n"
-        "\tfan1minoff [0 or 1]\r\n"
-        "\tfan2minoff [0 or 1]\r\n"
-        "\t\tSet to '1' to power off fan below minimum temp\r\n\r\n"
-        "\t\tStall checking is not performed when set to '1'\r\n\r\n"
-        "\ttemp1max [-55.0 to 125.0]\r\n"
-        "\t\tSets the temperature at which fan is set to the maximum\r\n"
-        "\t\tconfigured duty cycle\r\n\r\n"
-        "\ttemp1min [-55.0 to 125.0]\r\n"
-        "\t\tSets the temperature threshold at which fan starts to\r\n"
-        "\t\tincrease from the minimum configured duty cycle\r\n\r\n"
-        "\ttemp1hyst [0 to 180.0]\r\n"
-        "\t\tSets hysteresis when using 'minoff'. The fan will not switch off\r\n"
-        "\t\tuntil current temp is less than temp1min, minus temp1hyst\r\n\r\n"
-        "\ttemp2max [-55.0 to 125.0]\r\n"
-        "\ttemp2min [-55.0 to 125.0]\r\n"
-        "\ttemp2hyst [0 to 180.0]\r\n"
-        "\t\tConfiguration for sensor 2 will apply to fan 2 if it is\r\n"
-        "\t\tconnected. Otherwise fan 2 uses sensor 1 with temp2max/min/hyst\r\n\r\n"
-        "\tfan2enabled [0 or 1]\r\n"
-        "\t\tSet to '1' if fan 2 is connected\r\n\r\n"
-        "\ttemp1desc [desc]\r\n"
-        "\ttemp2desc [desc]\r\n"
-        "\t\tSets descriptions (15 chars max)\r\n\r\n"
-        "\treadtemp\r\n"
-        "\t\tProbe and read out all attached sensors\r\n\r\n"
-        "\tauthcheck\r\n"
-        "\t\tCheck authenticity of attached DS18B20 sensors\r\n\r\n"
-        "\tmanualassignment [0 or 1]\r\n"
-        "\t\tSet to '1' to enable manual assignment of sensor address-to-index\r\n\r\n"
-        "\tsensor1addr [addr or 'none']\r\n"
-        "\tsensor2addr [addr or 'none']\r\n"
-        "\t\tSets addresses of sensors\r\n\r\n"
-    );
-}
+static const char _g_help[] PROGMEM =
+    "\r\nCommands:\r\n\r\n"
+    "\tshow\r\n"
+    "\t\tShow current configuration\r\n\r\n"
+    "\tdefault\r\n"
+    "\t\tLoad the default configuration\r\n\r\n"
+    "\tsave\r\n"
+    "\t\tSave current configuration\r\n\r\n"
+    "\texit\r\n"
+    "\t\tExit this menu and start\r\n\r\n"
+    "\tfan1max [0 to 100]\r\n"
+    "\tfan2max [0 to 100]\r\n"
+    "\t\tSets the maximum duty cycle for fan\r\n\r\n"
+    "\tfan1min [0 to 100]\r\n"
+    "\tfan2min [0 to 100]\r\n"
+    "\t\tSets the minimum duty cycle for fan\r\n\r\n"
+    "\tfan1start [0 to 100]\r\n"
+    "\tfan2start [0 to 100]\r\n"
+    "\t\tSets the duty cycle to use between reset and first calculation\r\n"
+    "\t\tand when in the configuration prompt\r\n\r\n"
+    "\tfan1minrpm [0 to 65535]\r\n"
+    "\tfan2minrpm [0 to 65535]\r\n"
+    "\t\tSets the stall-restart threshold RPM for fan\r\n"
+    "\t\tTrue RPM. Versions before period timing showed twice this,\r\n"
+    "\t\tso halve a threshold carried over from one\r\n\r\n"
+    "\tfan1maxrpm [0 to 65535]\r\n"
+    "\tfan2maxrpm [0 to 65535]\r\n"
+    "\t\tSet to the full speed of the fan to control RPM instead of duty\r\n"
+    "\t\tcycle. fanXmin/fanXmax then set a percentage of this speed and\r\n"
+    "\t\tthe duty is adjusted to hold it. '0' to disable\r\n\r\n"
+    "\tfan1minoff [0 or 1]\r\n"
+    "\tfan2minoff [0 or 1]\r\n"
+    "\t\tSet to '1' to power off fan below minimum temp\r\n\r\n"
+    "\t\tStall checking is not performed when set to '1'\r\n\r\n"
+    "\ttemp1max [-55.0 to 125.0]\r\n"
+    "\t\tSets the temperature at which fan is set to the maximum\r\n"
+    "\t\tconfigured duty cycle\r\n\r\n"
+    "\ttemp1min [-55.0 to 125.0]\r\n"
+    "\t\tSets the temperature threshold at which fan starts to\r\n"
+    "\t\tincrease from the minimum configured duty cycle\r\n\r\n"
+    "\ttemp1hyst [0 to 180.0]\r\n"
+    "\t\tSets hysteresis when using 'minoff'. The fan will not switch off\r\n"
+    "\t\tuntil current temp is less than temp1min, minus temp1hyst\r\n\r\n"
+    "\ttemp1setpoint [-55.0 to 125.0]\r\n"
+    "\t\tSets the temperature to hold when ctlmode is '1'\r\n\r\n"
+    "\ttemp2max [-55.0 to 125.0]\r\n"
+    "\ttemp2min [-55.0 to 125.0]\r\n"
+    "\ttemp2hyst [0 to 180.0]\r\n"
+    "\ttemp2setpoint [-55.0 to 125.0]\r\n"
+    "\t\tConfiguration for sensor 2 will apply to fan 2 if it is\r\n"
+    "\t\tconnected. Otherwise fan 2 uses sensor 1 with temp2max/min/hyst\r\n\r\n"
+    "\tcurve1 [temp:duty ... or 'none']\r\n"
+    "\tcurve2 [temp:duty ... or 'none']\r\n"
+    "\t\tSets the fan curve used when ctlmode is '2'. 2 to " stringify(CURVE_MAX_POINTS) " points in\r\n"
+    "\t\tascending temperature order, e.g. 'curve1 35.0:20 45.0:100'\r\n\r\n"
+    "\tctlmode [0 to 2]\r\n"
+    "\t\tSelects how duty is calculated from temperature. '0' ramps\r\n"
+    "\t\tlinearly between tempXmin and tempXmax. '1' uses a PID loop to hold\r\n"
+    "\t\ttempXsetpoint. '2' follows 'curveX'. All are limited to the fan\r\n"
+    "\t\tmin/max duty.\r\n"
+    "\t\tSwitching off below the minimum temp still applies\r\n\r\n"
+    "\tpidkp [0 to 100.0]\r\n"
+    "\t\tProportional gain. Percent duty per degree above setpoint\r\n\r\n"
+    "\tpidki [0 to 100.0]\r\n"
+    "\t\tIntegral gain. Percent duty per degree above setpoint, per second\r\n\r\n"
+    "\tpidkd [0 to 100.0]\r\n"
+    "\t\tDerivative gain. Percent duty per degree per second of rise\r\n\r\n"
+    "\tfanramp [0 to 100]\r\n"
+    "\t\tLimits how fast fan duty changes, in percent per second.\r\n"
+    "\t\t'0' applies changes immediately\r\n\r\n"
+    "\ttelemetry [0 or 1]\r\n"
+    "\t\tSet to '1' to send status as binary frames instead of text.\r\n"
+    "\t\tSee tools/telemetry.py\r\n\r\n"
+    "\tmodbusaddr [0 to 247]\r\n"
+    "\t\tSet to answer Modbus RTU requests at this slave address instead\r\n"
+    "\t\tof printing status. '0' to disable. See modbus.h for registers\r\n\r\n"
+    "\tbaud [9600 to 153600]\r\n"
+    "\t\tConsole baud rate once this prompt has been and gone. Startup and\r\n"
+    "\t\tthis prompt are always at " stringify(UART_BAUD) ". 9600, 19200, 38400, 57600,\r\n"
+    "\t\t76800 or 153600 with the 12.288MHz crystal\r\n\r\n"
+    "\tfan2enabled [0 or 1]\r\n"
+    "\t\tSet to '1' if fan 2 is connected\r\n\r\n"
+    "\ttemp1desc [desc]\r\n"
+    "\ttemp2desc [desc]\r\n"
+    "\t\tSets descriptions (15 chars max)\r\n\r\n"
+    "\tsensorres [9 to 12]\r\n"
+    "\t\tSets the DS18B20 resolution in bits. Lower resolutions convert\r\n"
+    "\t\tfaster (94, 188, 375 or 750ms). Applied to the sensors at startup\r\n\r\n"
+    "\treadtemp\r\n"
+    "\t\tProbe and read out all attached sensors\r\n\r\n"
+    "\tauthcheck\r\n"
+    "\t\tCheck authenticity of attached DS18B20 sensors\r\n\r\n"
+    "\tmanualassignment [0 or 1]\r\n"
+    "\t\tSet to '1' to enable manual assignment of sensor address-to-index\r\n\r\n"
+    "\tsensor1addr [addr or 'none']\r\n"
+    "\tsensor2addr [addr or 'none']\r\n"
+    "\t\tSets addresses of sensors\r\n\r\n";
 
 static inline int8_t configuration_prompt_handler(char *text, sys_config_t *config)
 {
@@ -579,6 +925,12 @@ static inline int8_t configuration_prompt_handler(char *text, sys_config_t *conf
     else if (!stricmp(command, "fan2minrpm")) {
         return parse_param(&config->fan2_minrpm, PARAM_U16, arg);
     }
+    else if (!stricmp(command, "fan1maxrpm")) {
+        return parse_param(&config->fan1_maxrpm, PARAM_U16, arg);
+    }
+    else if (!stricmp(command, "fan2maxrpm")) {
+        return parse_param(&config->fan2_maxrpm, PARAM_U16, arg);
+    }
     else if (!stricmp(command, "temp1max")) {
         return parse_param(&config->temp1_max, PARAM_I16_1DP_TEMP, arg);
     }
@@ -597,6 +949,18 @@ static inline int8_t configuration_prompt_handler(char *text, sys_config_t *conf
     else if (!stricmp(command, "temp2hyst")) {
         return parse_param(&config->temp2_hyst, PARAM_U16_1DP_TEMPMAX, arg);
     }
+    else if (!stricmp(command, "temp1setpoint")) {
+        return parse_param(&config->temp1_setpoint, PARAM_I16_1DP_TEMP, arg);
+    }
+    else if (!stricmp(command, "temp2setpoint")) {
+        return parse_param(&config->temp2_setpoint, PARAM_I16_1DP_TEMP, arg);
+    }
+    else if (!stricmp(command, "curve1")) {
+        return parse_curve(&config->curve1_points, config->curve1_temp, config->curve1_duty, arg);
+    }
+    else if (!stricmp(command, "curve2")) {
+        return parse_curve(&config->curve2_points, config->curve2_temp, config->curve2_duty, arg);
+    }
     else if (!stricmp(command, "fan2enabled")) {
         return parse_param(&config->fan2_enabled, PARAM_U8_BIT, arg);
     }
@@ -612,6 +976,33 @@ static inline int8_t configuration_prompt_handler(char *text, sys_config_t *conf
     else if (!stricmp(command, "temp2desc")) {
         return parse_param(config->temp2_desc, PARAM_DESC, arg);
     }
+    else if (!stricmp(command, "ctlmode")) {
+        return parse_param(&config->ctl_mode, PARAM_U8_MODE, arg);
+    }
+    else if (!stricmp(command, "pidkp")) {
+        return parse_param(&config->pid_kp, PARAM_U16_1DP_GAIN, arg);
+    }
+    else if (!stricmp(command, "pidki")) {
+        return parse_param(&config->pid_ki, PARAM_U16_1DP_GAIN, arg);
+    }
+    else if (!stricmp(command, "pidkd")) {
+        return parse_param(&config->pid_kd, PARAM_U16_1DP_GAIN, arg);
+    }
+    else if (!stricmp(command, "fanramp")) {
+        return parse_param(&config->fan_ramp, PARAM_U8_PCT, arg);
+    }
+    else if (!stricmp(command, "telemetry")) {
+        return parse_param(&config->telemetry, PARAM_U8_BIT, arg);
+    }
+    else if (!stricmp(command, "modbusaddr")) {
+        return parse_param(&config->modbus_addr, PARAM_U8_MBADDR, arg);
+    }
+    else if (!stricmp(command, "baud")) {
+        return parse_baud(&config->console_baud, arg);
+    }
+    else if (!stricmp(command, "sensorres")) {
+        return parse_param(&config->sensor_res, PARAM_U8_RES, arg);
+    }
     else if (!stricmp(command, "manualassignment")) {
         return parse_param(&config->manual_assignment, PARAM_U8_BIT, arg);
     }
@@ -628,24 +1019,32 @@ static inline int8_t configuration_prompt_handler(char *text, sys_config_t *conf
     }
     else if (!stricmp(command, "default")) {
         default_configuration(config);
+        _g_stored = true;
         printf("\r\nDefault configuration loaded.\r\n\r\n");
         return 0;
     }
     else if (!stricmp(command, "exit")) {
-        printf("\r\nStarting...\r\n");
+        if (_g_shell_open)
+            printf("\r\nBack to status output\r\n");
+        else
+            printf("\r\nStarting...\r\n");
         return -1;
     }
     else if (!stricmp(command, "readtemp")) {
+        if (sensors_in_use())
+            return 1;
         do_readtemp();
     }
     else if (!stricmp(command, "authcheck")) {
+        if (sensors_in_use())
+            return 1;
         do_authcheck();
     }
     else if (!stricmp(command, "show")) {
-        do_show(config);
+        list_start(LIST_SHOW);
     }
     else if ((!stricmp(command, "help") || !stricmp(command, "?"))) {
-        do_help();
+        list_start(LIST_HELP);
         return 0;
     }
     else
@@ -664,21 +1063,36 @@ static void default_configuration(sys_config_t *config)
     config->fan1_min = DEF_PCT_MIN;
     config->fan1_start = DEF_PCT_MIN;
     config->fan1_minrpm = DEF_MIN_RPM;
+    config->fan1_maxrpm = DEF_MAX_RPM;
     config->fan2_max = DEF_PCT_MAX;
     config->fan2_min = DEF_PCT_MIN;
     config->fan2_start = DEF_PCT_MIN;
     config->fan2_minrpm = DEF_MIN_RPM;
+    config->fan2_maxrpm = DEF_MAX_RPM;
     config->temp1_min = DEF_TEMP_MIN;
     config->temp1_max = DEF_TEMP_MAX;
     config->temp1_hyst = 0;
     config->temp2_min = DEF_TEMP_MIN;
     config->temp2_max = DEF_TEMP_MAX;
     config->temp2_hyst = 0;
+    config->temp1_setpoint = DEF_TEMP_SETPOINT;
+    config->temp2_setpoint = DEF_TEMP_SETPOINT;
+    default_curve(&config->curve1_points, config->curve1_temp, config->curve1_duty);
+    default_curve(&config->curve2_points, config->curve2_temp, config->curve2_duty);
     config->fan2_enabled = false;
     config->fan1_minoff = false;
     config->fan2_minoff = false;
     config->temp1_desc[0] = 0;
     config->temp2_desc[0] = 0;
+    config->ctl_mode = CTL_MODE_LINEAR;
+    config->pid_kp = DEF_PID_KP;
+    config->pid_ki = DEF_PID_KI;
+    config->pid_kd = DEF_PID_KD;
+    config->fan_ramp = DEF_FAN_RAMP;
+    config->telemetry = false;
+    config->modbus_addr = 0;
+    config->console_baud = UART_BAUD;
+    config->sensor_res = DEF_SENSOR_RES;
     config->manual_assignment = false;
     memset(config->sensor1_addr, 0x00, OW_ROMCODE_SIZE);
     memset(config->sensor2_addr, 0x00, OW_ROMCODE_SIZE);
@@ -686,31 +1100,117 @@ static void default_configuration(sys_config_t *config)
 
 #endif /* !_SINGLEZONE_ */
 
+/* LIST_CHUNK bytes of the help text per call. False once past the end */
+static bool do_help(uint8_t part)
+{
+    uint16_t offset = (uint16_t)part * LIST_CHUNK;
+
+    if (offset >= sizeof(_g_help) - 1)
+        return false;
+
+    printf("%.*S", LIST_CHUNK, &_g_help[offset]);
+    return true;
+}
+
+/*
+ * The control loop owns the sensor buses while running. A search or
+ * conversion from here would cut across an async readout in flight,
+ * and block the console task for most of a second or more.
+ */
+static bool sensors_in_use(void)
+{
+    if (!_g_shell_open)
+        return false;
+
+    printf("Not while running. Reset with Ctrl+D and use the boot prompt\r\n");
+    return true;
+}
+
 static void do_readtemp(void)
 {
     uint8_t i;
     uint8_t num_sensors;
     uint8_t sensor_ids[MAX_SENSORS][OW_ROMCODE_SIZE];
+    int16_t readings[MAX_SENSORS];
     int16_t reading;
-    uint8_t ow_device_type = DS18B20_FAMILY_CODE;
-
-    if (onewire_search_devices(sensor_ids, &ow_device_type, &num_sensors, sizeof(ow_device_type)))
+    uint8_t ok = 0;
+#ifdef _OW_PARALLEL_
+    int16_t bus_reading[OWPAR_BUSES];
+    uint8_t bus_mask;
+    uint8_t bus_ok;
+    uint8_t bus;
+
+    owpar_init();
+    num_sensors = owpar_probe(sensor_ids, MAX_SENSORS, &bus_mask);
+    printf("\r\nFound %u of %u maximum sensors\r\n", num_sensors, MAX_SENSORS);
+#else
+    uint8_t families[] = DS18B20_FAMILIES;
+    uint8_t counts[sizeof(families)];
+    uint8_t f;
+#ifdef _OW_DS2482_800_
+    uint8_t channels[MAX_SENSORS];
+#endif /* _OW_DS2482_800_ */
+
+    num_sensors = 0;
+
+#ifdef _OW_DS2482_800_
+    if (onewire_search_channels(sensor_ids, channels, families, counts, sizeof(families)))
+#else
+    if (onewire_search_devices(sensor_ids, families, counts, sizeof(families)))
+#endif /* _OW_DS2482_800_ */
+    {
+        for (f = 0; f < sizeof(families); f++)
+            num_sensors += counts[f];
         printf("\r\nFound %u of %u maximum sensors\r\n", num_sensors, MAX_SENSORS);
+    }
     else
+    {
         printf("\r\nHardware error searching for sensors\r\n");
+    }
+#endif /* _OW_PARALLEL_ */
 
     if (!num_sensors)
         goto done;
-    
+
+#ifdef _OW_PARALLEL_
+    ds18b20_par_start_meas(bus_mask);
+
+    delay_10ms(75);
+
+    ds18b20_par_read_decicelsius(bus_mask, bus_reading, &bus_ok);
+
+    for (bus = 0, i = 0; bus < OWPAR_BUSES; bus++)
+    {
+        if (!(bus_mask & (1 << bus)))
+            continue;
+
+        if (bus_ok & (1 << bus))
+            ok |= (1 << i);
+
+        readings[i++] = bus_reading[bus];
+    }
+#else
     for (i = 0; i < num_sensors; i++)
+    {
+        config_channel(channels, i);
         ds18b20_start_meas(sensor_ids[i]);
+    }
 
     delay_10ms(75);
 
     for (i = 0; i < num_sensors; i++)
     {
-        if (ds18b20_read_decicelsius(sensor_ids[i], &reading))
+        config_channel(channels, i);
+        if (ds18b20_read_decicelsius(sensor_ids[i], &readings[i]))
+            ok |= (1 << i);
+    }
+#endif /* _OW_PARALLEL_ */
+
+    for (i = 0; i < num_sensors; i++)
+    {
+        if (ok & (1 << i))
         {
+            reading = readings[i];
             fixedpoint_sign(reading, reading);
 
             printf(
@@ -736,6 +1236,36 @@ static void do_readtemp(void)
     }
     
 done:
+#ifdef _I2C_TEMP_
+    {
+        i2ctemp_t i2c_sensors[MAX_SENSORS];
+        uint8_t num_i2c;
+
+        num_i2c = i2ctemp_probe(i2c_sensors, MAX_SENSORS - num_sensors);
+        printf("\r\nFound %u I2C sensors\r\n", num_i2c);
+
+        for (i = 0; i < num_i2c; i++)
+        {
+            if (!i2ctemp_read_decicelsius(&i2c_sensors[i], &reading))
+            {
+                printf("Failed to read sensor %u\r\n", num_sensors + i + 1);
+                continue;
+            }
+
+            fixedpoint_sign(reading, reading);
+
+            printf(
+                "\r\nSensor %u:\r\n"
+                "\tTemp (C) .............: %s%u.%u\r\n"
+                "\tI2C address .........: 0x%02X (%s)\r\n",
+                num_sensors + i + 1,
+                fixedpoint_arg(reading, reading),
+                i2c_sensors[i].addr,
+                i2ctemp_name(&i2c_sensors[i])
+            );
+        }
+    }
+#endif /* _I2C_TEMP_ */
     printf("\r\n");
 }
 
@@ -745,8 +1275,13 @@ static void do_authcheck(void)
     uint8_t num_sensors;
     uint8_t sensor_ids[MAX_SENSORS][OW_ROMCODE_SIZE];
     uint8_t ow_device_type = DS18B20_FAMILY_CODE;
+#ifdef _OW_DS2482_800_
+    uint8_t channels[MAX_SENSORS];
 
+    if (onewire_search_channels(sensor_ids, channels, &ow_device_type, &num_sensors, sizeof(ow_device_type)))
+#else
     if (onewire_search_devices(sensor_ids, &ow_device_type, &num_sensors, sizeof(ow_device_type)))
+#endif /* _OW_DS2482_800_ */
         printf("\r\nFound %u of %u maximum sensors\r\n\r\n", num_sensors, MAX_SENSORS);
     else
         printf("\r\nHardware error searching for sensors\r\n");
@@ -759,6 +1294,7 @@ static void do_authcheck(void)
     for (i = 0; i < num_sensors; i++)
     {
         wdt_reset();
+        config_channel(channels, i);
         ds18b20_authenticity_check(sensor_ids[i]);
         ds18b20_classify_sensor(sensor_ids[i]);
     }
@@ -796,6 +1332,9 @@ static uint8_t parse_param(void *param, uint8_t type, char *arg)
         case PARAM_U8_SIDX:
         case PARAM_U8_FCNT:
         case PARAM_U8_TCNT:
+        case PARAM_U8_RES:
+        case PARAM_U8_MODE:
+        case PARAM_U8_MBADDR:
             if (*arg == '-')
                 return 1;
             u8param = (uint8_t)atoi(arg);
@@ -809,11 +1348,18 @@ static uint8_t parse_param(void *param, uint8_t type, char *arg)
                 return 1;
             if (type == PARAM_U8_FCNT && u8param > MAX_FANS)
                 return 1;
+            if (type == PARAM_U8_RES && (u8param < 9 || u8param > 12))
+                return 1;
+            if (type == PARAM_U8_MODE && u8param > CTL_MODE_CURVE)
+                return 1;
+            if (type == PARAM_U8_MBADDR && u8param > MODBUS_ADDR_MAX)
+                return 1;
             *(uint8_t *)param = u8param;
             break;
         case PARAM_I16_1DP_TEMP:
         case PARAM_U16:
         case PARAM_U16_1DP_TEMPMAX:
+        case PARAM_U16_1DP_GAIN:
             s = strtok(arg, ".");
             i16param = atoi(s);
             switch (type)
@@ -826,6 +1372,7 @@ static uint8_t parse_param(void *param, uint8_t type, char *arg)
                     dp = 1;
                     break;
                 case PARAM_U16_1DP_TEMPMAX:
+                case PARAM_U16_1DP_GAIN:
                     i16param *= _1DP_BASE;
                     dp = 1;
                     un = 1;
@@ -860,6 +1407,11 @@ static uint8_t parse_param(void *param, uint8_t type, char *arg)
                 if (i16param > 1800)
                     i16param = 1800;
             }
+            if (type == PARAM_U16_1DP_GAIN)
+            {
+                if (i16param > 1000)
+                    i16param = 1000;
+            }
             *(int16_t *)param = i16param;
             break;
         case PARAM_DESC:
@@ -868,6 +1420,102 @@ static uint8_t parse_param(void *param, uint8_t type, char *arg)
             sparam[MAX_DESC - 1] = 0;
             break;
     }
+    _g_stored = true;
+    return 0;
+}
+
+static void default_curve(uint8_t *points, int16_t *temps, uint8_t *duties)
+{
+    *points = sizeof(_g_def_curve_duty);
+    memcpy_P(temps, _g_def_curve_temp, sizeof(_g_def_curve_temp));
+    memcpy_P(duties, _g_def_curve_duty, sizeof(_g_def_curve_duty));
+}
+
+static void print_owid(const char *name, uint8_t *addr)
+{
+    printf("\t%s: %02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X\r\n",
+        name, addr[0], addr[1], addr[2], addr[3], addr[4], addr[5], addr[6], addr[7]);
+}
+
+static void print_curve(const char *name, uint8_t points, int16_t *temps, uint8_t *duties)
+{
+    uint8_t i;
+
+    printf("\t%s: ", name);
+
+    if (!points)
+        printf("none");
+
+    for (i = 0; i < points; i++)
+    {
+        fixedpoint_sign(temps[i], temp);
+        printf("%s%u.%u:%u ", fixedpoint_arg(temps[i], temp), duties[i]);
+    }
+
+    printf("\r\n");
+}
+
+/*
+ * Space separated temp:duty pairs. Nothing is changed
+ * unless the whole list is valid.
+ */
+static int8_t parse_curve(uint8_t *points, int16_t *temps, uint8_t *duties, char *arg)
+{
+    int16_t newtemps[CURVE_MAX_POINTS];
+    uint8_t newduties[CURVE_MAX_POINTS];
+    uint8_t n = 0;
+    char *next;
+    char *duty;
+
+    if (!arg || !*arg)
+    {
+        printf("Error: Missing parameter\r\n");
+        return 1;
+    }
+
+    if (!stricmp(arg, "none"))
+    {
+        *points = 0;
+        _g_stored = true;
+        return 0;
+    }
+
+    while (arg)
+    {
+        next = strchr(arg, ' ');
+        if (next)
+            *next++ = 0;
+
+        if (*arg)
+        {
+            if (n == CURVE_MAX_POINTS)
+                return 1;
+
+            duty = strchr(arg, ':');
+            if (!duty)
+                return 1;
+            *duty++ = 0;
+
+            if (parse_param(&newtemps[n], PARAM_I16_1DP_TEMP, arg) || parse_param(&newduties[n], PARAM_U8_PCT, duty))
+                return 1;
+
+            if (n > 0 && newtemps[n] <= newtemps[n - 1])
+                return 1;
+
+            n++;
+        }
+
+        arg = next;
+    }
+
+    if (n < 2)
+        return 1;
+
+    *points = n;
+    memcpy(temps, newtemps, n * sizeof(int16_t));
+    memcpy(duties, newduties, n);
+    _g_stored = true;
+
     return 0;
 }
 
@@ -877,6 +1525,7 @@ static int8_t parse_owid(uint8_t *param, char *arg)
     if (!stricmp(arg, "none"))
     {
         memset(param, 0x00, OW_ROMCODE_SIZE);
+        _g_stored = true;
         return 0;
     }
     char *s = strtok(arg, ":");
@@ -887,6 +1536,23 @@ static int8_t parse_owid(uint8_t *param, char *arg)
         param[i] = (uint8_t)strtoul(s, NULL, 16);
         s = strtok(NULL, ":");
     } while (++i < OW_ROMCODE_SIZE);
+    _g_stored = true;
+    return 0;
+}
+
+static int8_t parse_baud(uint32_t *param, char *arg)
+{
+    uint32_t baud;
+    uint16_t ubrr;
+    bool u2x;
+
+    baud = strtoul(arg, NULL, 10);
+
+    if (!usart_baud_lookup(baud, &ubrr, &u2x))
+        return 1;
+
+    *param = baud;
+    _g_stored = true;
     return 0;
 }
 
@@ -938,145 +1604,157 @@ static void config_prev_command(char *cmdbuf, int8_t *count)
     printf("%s", cmdbuf);
 }
 
-static int get_string(char *str, int8_t max, uint8_t *ignore_lf)
+/*
+ * Line editor, fed a byte at a time. Returns CMD_PENDING until the line
+ * is finished, then its length, or -1 for Ctrl+C.
+ */
+static int8_t line_input(char *str, int8_t max, uint8_t *ignore_lf, unsigned char c)
 {
-    unsigned char c;
-    uint8_t state = CMD_READLINE;
     int8_t count;
 
-    count = 0;
-    do {
-        c = wdt_getch();
+    if (_g_line_state == CMD_ESCAPE) {
+        if (c == SEQ_CTRL_CHAR1)
+            _g_line_state = CMD_AWAIT_NAV;
+        else
+            _g_line_state = CMD_READLINE;
 
-        if (state == CMD_ESCAPE) {
-            if (c == SEQ_CTRL_CHAR1) {
-                state = CMD_AWAIT_NAV;
-                continue;
-            }
-            else {
-                state = CMD_READLINE;
-                continue;
-            }
+        return CMD_PENDING;
+    }
+    else if (_g_line_state == CMD_AWAIT_NAV)
+    {
+        if (c == SEQ_ARROW_UP) {
+            config_prev_command(str, &_g_line_count);
+            _g_line_state = CMD_READLINE;
         }
-        else if (state == CMD_AWAIT_NAV)
-        {
-            if (c == SEQ_ARROW_UP) {
-                config_prev_command(str, &count);
-                state = CMD_READLINE;
-                continue;
-            }
-            else if (c == SEQ_ARROW_DOWN) {
-                config_next_command(str, &count);
-                state = CMD_READLINE;
-                continue;
-            }
-            else if (c == SEQ_DEL) {
-                state = CMD_DEL;
-                continue;
-            }
-            else if (c == SEQ_HOME || c == SEQ_END || c == SEQ_INS || c == SEQ_PGUP || c == SEQ_PGDN) {
-                state = CMD_DROP_NAV;
-                continue;
-            }
-            else {
-                state = CMD_READLINE;
-                continue;
-            }
+        else if (c == SEQ_ARROW_DOWN) {
+            config_next_command(str, &_g_line_count);
+            _g_line_state = CMD_READLINE;
+        }
+        else if (c == SEQ_DEL) {
+            _g_line_state = CMD_DEL;
+        }
+        else if (c == SEQ_HOME || c == SEQ_END || c == SEQ_INS || c == SEQ_PGUP || c == SEQ_PGDN) {
+            _g_line_state = CMD_DROP_NAV;
+        }
+        else {
+            _g_line_state = CMD_READLINE;
         }
-        else if (state == CMD_DEL) {
-            if (c == SEQ_NAV_END && count) {
-                putch('\b');
-                putch(' ');
-                putch('\b');
-                count--;
-            }
 
-            state = CMD_READLINE;
-            continue;
+        return CMD_PENDING;
+    }
+    else if (_g_line_state == CMD_DEL) {
+        if (c == SEQ_NAV_END && _g_line_count) {
+            putch('\b');
+            putch(' ');
+            putch('\b');
+            _g_line_count--;
         }
-        else if (state == CMD_DROP_NAV) {
-            state = CMD_READLINE;
-            continue;
+
+        _g_line_state = CMD_READLINE;
+        return CMD_PENDING;
+    }
+    else if (_g_line_state == CMD_DROP_NAV) {
+        _g_line_state = CMD_READLINE;
+        return CMD_PENDING;
+    }
+
+    if (_g_line_count >= max) {
+        _g_line_count--;
+        goto done;
+    }
+
+    if (c == 19) /* Swallow XOFF */
+        return CMD_PENDING;
+
+    if (c == CTL_U) {
+        if (_g_line_count) {
+            cmd_erase_line(_g_line_count);
+            *(str) = 0;
+            _g_line_count = 0;
         }
-        else
-        {
-            if (count >= max) {
-                count--;
-                break;
-            }
+        return CMD_PENDING;
+    }
 
-            if (c == 19) /* Swallow XOFF */
-                continue;
+    if (c == SEQ_ESCAPE_CHAR) {
+        _g_line_state = CMD_ESCAPE;
+        return CMD_PENDING;
+    }
 
-            if (c == CTL_U) {
-                if (count) {
-                    cmd_erase_line(count);
-                    *(str) = 0;
-                    count = 0;
-                }
-                continue;
-            }
+    /* Unix telnet sends:    <CR> <NUL>
+    * Windows telnet sends: <CR> <LF>
+    */
+    if (*ignore_lf && (c == '\n' || c == 0x00)) {
+        *ignore_lf = 0;
+        return CMD_PENDING;
+    }
 
-            if (c == SEQ_ESCAPE_CHAR) {
-                state = CMD_ESCAPE;
-                continue;
-            }
+    if (c == 3) { /* Ctrl+C */
+        _g_line_count = 0;
+        return -1;
+    }
 
-            /* Unix telnet sends:    <CR> <NUL>
-            * Windows telnet sends: <CR> <LF>
-            */
-            if (*ignore_lf && (c == '\n' || c == 0x00)) {
-                *ignore_lf = 0;
-                continue;
-            }
+    if (c == '\b' || c == 0x7F) {
+        if (!_g_line_count)
+            return CMD_PENDING;
 
-            if (c == 3) { /* Ctrl+C */
-                return -1;
-            }
+        putch('\b');
+        putch(' ');
+        putch('\b');
+        _g_line_count--;
+        return CMD_PENDING;
+    }
 
-            if (c == '\b' || c == 0x7F) {
-                if (!count)
-                    continue;
+    if (c == '\r') {
+        *ignore_lf = 1;
+        goto done;
+    }
 
-                putch('\b');
-                putch(' ');
-                putch('\b');
-                count--;
-                continue;
-            }
-            if (c != '\n' && c != '\r') {
-                putch(c);
-            }
-            else {
-                if (c == '\r') {
-                    *ignore_lf = 1;
-                    break;
-                }
+    if (c == '\n')
+        goto done;
 
-                if (c == '\n')
-                    break;
-            }
-            str[count] = c;
-            count++;
-        }
-    } while (1);
+    putch(c);
+    str[_g_line_count++] = c;
+    return CMD_PENDING;
 
-    str[count] = 0;
+done:
+    str[_g_line_count] = 0;
+    count = _g_line_count;
+    _g_line_count = 0;
     return count;
 }
 
+static int get_string(char *str, int8_t max, uint8_t *ignore_lf)
+{
+    int8_t ret;
+
+    do {
+        ret = line_input(str, max, ignore_lf, wdt_getch());
+    } while (ret == CMD_PENDING);
+
+    return ret;
+}
+
 static int8_t get_line(char *str, int8_t max, uint8_t *ignore_lf)
 {
-    uint8_t i;
     int8_t ret;
-    int8_t tostore = -1;
 
     ret = get_string(str, max, ignore_lf);
 
     if (ret <= 0) {
         return ret;
     }
-    
+
+    line_history(str);
+
+    return ret;
+}
+
+/* Files a finished line in the history and ends it on the terminal */
+static void line_history(char *str)
+{
+    uint8_t i;
+    int8_t tostore = -1;
+
     if (_g_next_history >= CMD_MAX_HISTORY)
         _g_next_history = 0;
     else
@@ -1110,10 +1788,132 @@ static int8_t get_line(char *str, int8_t max, uint8_t *ignore_lf)
     }
 
     printf("\r\n");
+}
 
-    return ret;
+
+/*
+ * Modbus holding registers. The scalar settings, in the order 'show'
+ * lists them, with the same limits as the console.
+ */
+#define REG_U8               0
+#define REG_U16              1
+#define REG_I16              2
+
+typedef struct {
+    uint8_t offset;
+    uint8_t type;
+    int16_t min;
+    uint16_t max;
+} config_reg_t;
+
+#define config_reg(field, type, min, max) { offsetof(sys_config_t, field), type, min, max }
+
+static const config_reg_t _g_config_regs[] PROGMEM = {
+#ifdef _SINGLEZONE_
+    config_reg(num_fans, REG_U8, 0, MAX_FANS),
+    config_reg(fans_max, REG_U8, 0, 100),
+    config_reg(fans_min, REG_U8, 0, 100),
+    config_reg(fans_start, REG_U8, 0, 100),
+    config_reg(fans_minrpm, REG_U16, 0, 65535),
+    config_reg(fans_maxrpm, REG_U16, 0, 65535),
+    config_reg(fans_minoff, REG_U8, 0, 1),
+    config_reg(min_temps, REG_U8, 0, MAX_SENSORS),
+    config_reg(temp_max, REG_I16, -550, 1250),
+    config_reg(temp_min, REG_I16, -550, 1250),
+    config_reg(temp_hyst, REG_U16, 0, 1800),
+    config_reg(temp_setpoint, REG_I16, -550, 1250),
+#else
+    config_reg(fan1_max, REG_U8, 0, 100),
+    config_reg(fan1_min, REG_U8, 0, 100),
+    config_reg(fan1_start, REG_U8, 0, 100),
+    config_reg(fan1_minrpm, REG_U16, 0, 65535),
+    config_reg(fan1_maxrpm, REG_U16, 0, 65535),
+    config_reg(fan1_minoff, REG_U8, 0, 1),
+    config_reg(fan2_enabled, REG_U8, 0, 1),
+    config_reg(fan2_max, REG_U8, 0, 100),
+    config_reg(fan2_min, REG_U8, 0, 100),
+    config_reg(fan2_start, REG_U8, 0, 100),
+    config_reg(fan2_minrpm, REG_U16, 0, 65535),
+    config_reg(fan2_maxrpm, REG_U16, 0, 65535),
+    config_reg(fan2_minoff, REG_U8, 0, 1),
+    config_reg(temp1_max, REG_I16, -550, 1250),
+    config_reg(temp1_min, REG_I16, -550, 1250),
+    config_reg(temp1_hyst, REG_U16, 0, 1800),
+    config_reg(temp1_setpoint, REG_I16, -550, 1250),
+    config_reg(temp2_max, REG_I16, -550, 1250),
+    config_reg(temp2_min, REG_I16, -550, 1250),
+    config_reg(temp2_hyst, REG_U16, 0, 1800),
+    config_reg(temp2_setpoint, REG_I16, -550, 1250),
+#endif /* _SINGLEZONE_ */
+    config_reg(ctl_mode, REG_U8, 0, CTL_MODE_CURVE),
+    config_reg(pid_kp, REG_U16, 0, 1000),
+    config_reg(pid_ki, REG_U16, 0, 1000),
+    config_reg(pid_kd, REG_U16, 0, 1000),
+    config_reg(fan_ramp, REG_U8, 0, 100),
+    config_reg(telemetry, REG_U8, 0, 1),
+    config_reg(modbus_addr, REG_U8, 0, MODBUS_ADDR_MAX),
+    config_reg(sensor_res, REG_U8, 9, 12),
+    config_reg(manual_assignment, REG_U8, 0, 1),
+};
+
+#define CONFIG_NUM_REGS      (sizeof(_g_config_regs) / sizeof(_g_config_regs[0]))
+
+uint8_t configuration_read_reg(sys_config_t *config, uint16_t reg, uint16_t *val)
+{
+    config_reg_t r;
+    uint8_t *field;
+
+    if (reg >= CONFIG_NUM_REGS)
+        return MODBUS_EX_ADDRESS;
+
+    memcpy_P(&r, &_g_config_regs[reg], sizeof(r));
+    field = (uint8_t *)config + r.offset;
+
+    if (r.type == REG_U8)
+        *val = *field;
+    else
+        *val = *(uint16_t *)field;
+
+    return MODBUS_OK;
 }
 
+uint8_t configuration_write_reg(sys_config_t *config, uint16_t reg, uint16_t val)
+{
+    config_reg_t r;
+    uint8_t *field;
+
+    if (reg == MODBUS_HR_COMMAND)
+    {
+        if (val != MODBUS_CMD_SAVE && val != MODBUS_CMD_RESTART)
+            return MODBUS_EX_VALUE;
+
+        save_configuration(config);
+        return val == MODBUS_CMD_RESTART ? MODBUS_RESET : MODBUS_OK;
+    }
+
+    if (reg >= CONFIG_NUM_REGS)
+        return MODBUS_EX_ADDRESS;
+
+    memcpy_P(&r, &_g_config_regs[reg], sizeof(r));
+    field = (uint8_t *)config + r.offset;
+
+    if (r.type == REG_I16)
+    {
+        if ((int16_t)val < r.min || (int16_t)val > (int16_t)r.max)
+            return MODBUS_EX_VALUE;
+    }
+    else if (val < (uint16_t)r.min || val > r.max)
+    {
+        return MODBUS_EX_VALUE;
+    }
+
+    if (r.type == REG_U8)
+        *field = val;
+    else
+        *(uint16_t *)field = val;
+
+    return MODBUS_OK;
+}
 
 void load_configuration(sys_config_t *config)
 {
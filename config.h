@@ -27,6 +27,10 @@
 
 #define OW_ROMCODE_SIZE 8
 
+#define CTL_MODE_LINEAR 0
+#define CTL_MODE_PID    1
+#define CTL_MODE_CURVE  2
+
 typedef struct {
     uint16_t magic;
 #ifdef _SINGLEZONE_
@@ -35,11 +39,16 @@ typedef struct {
     uint8_t fans_min;
     uint8_t fans_start;
     uint16_t fans_minrpm;
+    uint16_t fans_maxrpm;
     bool fans_minoff;
     uint8_t min_temps;
     int16_t temp_min;
     int16_t temp_max;
     uint16_t temp_hyst;
+    int16_t temp_setpoint;
+    uint8_t curve_points;
+    int16_t curve_temp[CURVE_MAX_POINTS];
+    uint8_t curve_duty[CURVE_MAX_POINTS];
     char temp1_desc[MAX_DESC];
     char temp2_desc[MAX_DESC];
     char temp3_desc[MAX_DESC];
@@ -49,11 +58,13 @@ typedef struct {
     uint8_t fan1_min;
     uint8_t fan1_start;
     uint16_t fan1_minrpm;
+    uint16_t fan1_maxrpm;
     bool fan1_minoff;
     uint8_t fan2_max;
     uint8_t fan2_min;
     uint8_t fan2_start;
     uint16_t fan2_minrpm;
+    uint16_t fan2_maxrpm;
     bool fan2_minoff;
     int16_t temp1_min;
     int16_t temp1_max;
@@ -61,10 +72,27 @@ typedef struct {
     int16_t temp2_min;
     int16_t temp2_max;
     uint16_t temp2_hyst;
+    int16_t temp1_setpoint;
+    int16_t temp2_setpoint;
+    uint8_t curve1_points;
+    int16_t curve1_temp[CURVE_MAX_POINTS];
+    uint8_t curve1_duty[CURVE_MAX_POINTS];
+    uint8_t curve2_points;
+    int16_t curve2_temp[CURVE_MAX_POINTS];
+    uint8_t curve2_duty[CURVE_MAX_POINTS];
     bool fan2_enabled;
     char temp1_desc[MAX_DESC];
     char temp2_desc[MAX_DESC];
 #endif /* _SINGLEZONE_ */
+    uint8_t ctl_mode;
+    uint16_t pid_kp;
+    uint16_t pid_ki;
+    uint16_t pid_kd;
+    uint8_t fan_ramp;
+    bool telemetry;
+    uint8_t modbus_addr;
+    uint32_t console_baud;
+    uint8_t sensor_res;
     bool manual_assignment;
     uint8_t sensor1_addr[OW_ROMCODE_SIZE];
     uint8_t sensor2_addr[OW_ROMCODE_SIZE];
@@ -75,7 +103,13 @@ typedef struct {
 } sys_config_t;
 
 void configuration_bootprompt(sys_config_t *config);
+void configuration_shell_open(void);
+bool configuration_shell_active(void);
+bool configuration_shell(sys_config_t *config, char c);
+bool configuration_shell_print(sys_config_t *config);
 void load_configuration(sys_config_t *config);
 void set_start_duty(sys_config_t *config);
+uint8_t configuration_read_reg(sys_config_t *config, uint16_t reg, uint16_t *val);
+uint8_t configuration_write_reg(sys_config_t *config, uint16_t reg, uint16_t val);
 
 #endif /* __CONFIG_H__ */
\ No newline at end of file
@@ -25,8 +25,11 @@
 #include <util/delay.h>
 
 #include "config.h"
+#include "iopins.h"
 #include "onewire.h"
 #include "ow_bitbang.h"
+#include "ow_async.h"
+#include "ow_parallel.h"
 #include "ds18x20.h"
 #include "ds2482.h"
 #include "crc8.h"
@@ -40,7 +43,10 @@
 #define DS18B20_READ_ROM                0x33
 #define DS18B20_SP_SIZE                 9
 #define DS18B20_READ                    0xBE
+#define DS18B20_WRITE                   0x4E
+#define DS18B20_COPY                    0x48
 #define DS18B20_CONVERT_T               0x44
+#define DS18B20_READ_POWER_SUPPLY       0xB4
 
 #define DS18B20_CONF_REG                4
 #define DS18B20_9_BIT                   0
@@ -48,6 +54,8 @@
 #define DS18B20_11_BIT                  (1 << 6)
 #define DS18B20_12_BIT                  ((1 << 6) | (1 << 5))
 #define DS18B20_RES_MASK                ((1 << 6) | (1 << 5))
+#define DS18B20_CONF_RESERVED           0x1F
+#define DS18B20_TCOPY_MS                10
 #define DS18B20_9_BIT_UNDF              ((1 << 0) | (1 << 1) | (1 << 2))
 #define DS18B20_10_BIT_UNDF             ((1 << 0) | (1 << 1))
 #define DS18B20_11_BIT_UNDF             ((1 << 0))
@@ -76,7 +84,7 @@ static bool ds18b20_read_scratchpad(uint8_t *id, uint8_t *sp, uint8_t n)
 {
     uint8_t data = DS18B20_READ;
 
-    if (!ow_select(id))
+    if (!onewire_select(id))
         return false;
 
     if (!ow_write(&data, 1))
@@ -168,16 +176,266 @@ bool ds18b20_read_decicelsius(uint8_t *id, int16_t *decicelsius)
     return true;
 }
 
+#ifdef _OW_ASYNC_
+
+static uint8_t _g_async_sp[DS18B20_SP_SIZE];
+
+/* Same as ds18b20_read_decicelsius(), but the bus runs in the background */
+bool ds18b20_read_start(uint8_t *id)
+{
+    uint8_t data = DS18B20_READ;
+
+    return owasync_start(id, &data, 1, _g_async_sp, DS18B20_SP_SIZE);
+}
+
+/* Call once owasync_busy() returns false */
+bool ds18b20_read_finish(int16_t *decicelsius)
+{
+    int16_t ret;
+
+    if (!owasync_result() || crc8(_g_async_sp, DS18B20_SP_SIZE))
+        return false;
+
+    ret = ds18b20_raw_to_decicelsius(_g_async_sp);
+
+    if (ret == DS18B20_INVALID_DECICELSIUS)
+        return false;
+
+    *decicelsius = ret;
+    return true;
+}
+
+#endif /* _OW_ASYNC_ */
+
 bool ds18b20_start_meas(uint8_t *id)
 {
     uint8_t data = DS18B20_CONVERT_T;
 
-    if (!ow_select(id))
+    if (!onewire_select(id))
         return false;
 
     return ow_write(&data, 1);
 }
 
+/*
+ * Skip ROM + Convert T. Every device on the bus starts converting at
+ * once, so only use this when the bus holds nothing but DS18B20s
+ * (or compatibles).
+ */
+bool ds18b20_start_meas_all(void)
+{
+    return ds18b20_start_meas(NULL);
+}
+
+/*
+ * Writes the configuration register, keeping the alarm bytes, and
+ * copies it to the sensor EEPROM so it survives a power cycle.
+ * Nothing is written if the sensor is already set up.
+ */
+bool ds18b20_set_resolution(uint8_t *id, uint8_t bits)
+{
+    uint8_t sp[DS18B20_SP_SIZE];
+    uint8_t data[4];
+    uint8_t conf = ((bits - 9) << 5) | DS18B20_CONF_RESERVED;
+
+    if (!ds18b20_read_scratchpad(id, sp, DS18B20_SP_SIZE))
+        return false;
+
+    if (sp[DS18B20_CONF_REG] == conf)
+        return true;
+
+    data[0] = DS18B20_WRITE;
+    data[1] = sp[2];
+    data[2] = sp[3];
+    data[3] = conf;
+
+    if (!onewire_select(id))
+        return false;
+
+    if (!ow_write(data, sizeof(data)))
+        return false;
+
+    data[0] = DS18B20_COPY;
+
+    if (!onewire_select(id))
+        return false;
+
+    if (!ow_write(data, 1))
+        return false;
+
+    _delay_ms(DS18B20_TCOPY_MS);
+
+    return true;
+}
+
+/*
+ * Must directly follow Convert T with no other bus traffic in between.
+ * The sensor holds read time slots low until the conversion is done,
+ * so this only works for externally powered sensors. After a broadcast
+ * Convert T the slot reads high once the slowest sensor has finished.
+ */
+bool ds18b20_conv_complete(bool *complete)
+{
+    bool bit = true;
+
+    if (!ow_bit_io(&bit))
+        return false;
+
+    *complete = bit;
+    return true;
+}
+
+/* Parasite powered sensors pull the bus low during the read slot */
+bool ds18b20_parasite_powered(bool *parasite)
+{
+    uint8_t data = DS18B20_READ_POWER_SUPPLY;
+    bool bit = true;
+
+    if (!ow_select(NULL))
+        return false;
+
+    if (!ow_write(&data, 1))
+        return false;
+
+    if (!ow_bit_io(&bit))
+        return false;
+
+    *parasite = !bit;
+    return true;
+}
+
+#ifdef _OW_PARALLEL_
+
+/*
+ * One sensor per bus on ow_parallel.c. Each call runs the same
+ * transaction on every bus in mask at once, addressed with Skip ROM.
+ */
+
+bool ds18b20_par_start_meas(uint8_t mask)
+{
+    return owpar_skip(mask, DS18B20_CONVERT_T) != 0;
+}
+
+/*
+ * decicelsius has OWPAR_BUSES entries, indexed by bus. *ok gets the
+ * buses that read back a good scratchpad.
+ */
+bool ds18b20_par_read_decicelsius(uint8_t mask, int16_t *decicelsius, uint8_t *ok)
+{
+    uint8_t sp[OWPAR_BUSES][DS18B20_SP_SIZE];
+    uint8_t present;
+    int16_t ret;
+    uint8_t i;
+
+    *ok = 0;
+
+    present = owpar_skip(mask, DS18B20_READ);
+    if (!present)
+        return false;
+
+    owpar_read(present, sp[0], DS18B20_SP_SIZE);
+
+    for (i = 0; i < OWPAR_BUSES; i++)
+    {
+        if (!(present & (1 << i)) || crc8(sp[i], DS18B20_SP_SIZE))
+            continue;
+
+        ret = ds18b20_raw_to_decicelsius(sp[i]);
+
+        if (ret == DS18B20_INVALID_DECICELSIUS)
+            continue;
+
+        decicelsius[i] = ret;
+        *ok |= (1 << i);
+    }
+
+    return true;
+}
+
+/* Only at startup, so one bus at a time. The alarm bytes differ per sensor */
+bool ds18b20_par_set_resolution(uint8_t mask, uint8_t bits)
+{
+    uint8_t sp[OWPAR_BUSES][DS18B20_SP_SIZE];
+    uint8_t conf = ((bits - 9) << 5) | DS18B20_CONF_RESERVED;
+    uint8_t bus;
+    bool ret = true;
+
+    for (bus = 0; bus < OWPAR_BUSES; bus++)
+    {
+        uint8_t m = 1 << bus;
+
+        if (!(mask & m))
+            continue;
+
+        if (!owpar_skip(m, DS18B20_READ))
+        {
+            ret = false;
+            continue;
+        }
+
+        owpar_read(m, sp[0], DS18B20_SP_SIZE);
+
+        if (crc8(sp[bus], DS18B20_SP_SIZE))
+        {
+            ret = false;
+            continue;
+        }
+
+        if (sp[bus][DS18B20_CONF_REG] == conf)
+            continue;
+
+        sp[bus][DS18B20_CONF_REG] = conf;
+
+        if (!owpar_skip(m, DS18B20_WRITE))
+        {
+            ret = false;
+            continue;
+        }
+
+        owpar_write(m, &sp[bus][2], 3);
+
+        if (!owpar_skip(m, DS18B20_COPY))
+        {
+            ret = false;
+            continue;
+        }
+
+        _delay_ms(DS18B20_TCOPY_MS);
+    }
+
+    return ret;
+}
+
+/* As ds18b20_conv_complete(), done once every bus reads 1 */
+bool ds18b20_par_conv_complete(uint8_t mask, bool *complete)
+{
+    uint8_t ones;
+
+    if (!owpar_bit_io(mask, &ones))
+        return false;
+
+    *complete = (ones == mask);
+    return true;
+}
+
+bool ds18b20_par_parasite_powered(uint8_t mask, bool *parasite)
+{
+    uint8_t present;
+    uint8_t ones;
+
+    present = owpar_skip(mask, DS18B20_READ_POWER_SUPPLY);
+    if (!present)
+        return false;
+
+    if (!owpar_bit_io(present, &ones))
+        return false;
+
+    *parasite = (ones != present);
+    return true;
+}
+
+#endif /* _OW_PARALLEL_ */
+
 #ifdef _DS18B20_AUTHCHECK_
 
 // Taken from https://github.com/cpetrich/counterfeit_DS18B20
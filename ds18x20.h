@@ -20,12 +20,34 @@
 #define __ds18b20_H__
 
 #define DS18B20_FAMILY_CODE         0x28
+#define DS28EA00_FAMILY_CODE        0x42    /* Same command set. Overdrive capable */
+
+/* Everything the readout treats as a temperature sensor */
+#define DS18B20_FAMILIES            { DS18B20_FAMILY_CODE, DS28EA00_FAMILY_CODE }
 
 #define DS18B20_TCONV_12BIT         750
 
+/* Conversion time halves for each bit of resolution dropped */
+#define DS18B20_TCONV(bits)         (DS18B20_TCONV_12BIT >> (12 - (bits)))
+
 bool ds18b20_find_sensor(uint8_t *diff, uint8_t *id);
 bool ds18b20_start_meas(uint8_t *id);
+bool ds18b20_start_meas_all(void);
+bool ds18b20_set_resolution(uint8_t *id, uint8_t bits);
+bool ds18b20_conv_complete(bool *complete);
+bool ds18b20_parasite_powered(bool *parasite);
 bool ds18b20_read_decicelsius(uint8_t *id, int16_t *decicelsius);
+#ifdef _OW_ASYNC_
+bool ds18b20_read_start(uint8_t *id);
+bool ds18b20_read_finish(int16_t *decicelsius);
+#endif /* _OW_ASYNC_ */
+#ifdef _OW_PARALLEL_
+bool ds18b20_par_start_meas(uint8_t mask);
+bool ds18b20_par_read_decicelsius(uint8_t mask, int16_t *decicelsius, uint8_t *ok);
+bool ds18b20_par_set_resolution(uint8_t mask, uint8_t bits);
+bool ds18b20_par_conv_complete(uint8_t mask, bool *complete);
+bool ds18b20_par_parasite_powered(uint8_t mask, bool *parasite);
+#endif /* _OW_PARALLEL_ */
 bool ds18b20_search_sensors(uint8_t *count, uint8_t(*sensor_ids)[OW_ROMCODE_SIZE]);
 void ds18b20_authenticity_check(uint8_t *addr);
 void ds18b20_classify_sensor(uint8_t *addr);
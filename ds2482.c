@@ -21,12 +21,14 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "config.h"
 #include "ds2482.h"
 #include "onewire.h"
 #include "ds18x20.h"
 #include "i2c.h"
+#include "ow_async.h"
 
 #ifdef _OW_DS2482_
 
@@ -71,30 +73,116 @@
 #define DS2482_DEV_ADDR 0x18
 
 #ifdef _OW_DS2482_800_
-static const uint8_t ds2482_chan_wr[8] =
+static const uint8_t ds2482_chan_wr[DS2482_CHANNELS] =
     {0xF0, 0xE1, 0xD2, 0xC3, 0xB4, 0xA5, 0x96, 0x87};
+/* What the channel selection register reads back as */
+static const uint8_t ds2482_chan_rd[DS2482_CHANNELS] =
+    {0xB8, 0xB1, 0xAA, 0xA3, 0x9C, 0x95, 0x8E, 0x87};
 #endif /* _OW_DS2482_800_ */
 
 static uint8_t _g_devAddr;
+static uint8_t _g_devCfg;
+#ifdef _OW_DS2482_800_
+static uint8_t _g_channel;
+#endif /* _OW_DS2482_800_ */
 
 static bool ds2482_reset(void);
 static bool ds2482_write_byte(const uint8_t data);
+static bool ds2482_write_config(uint8_t cfg);
+static bool ds2482_exec(uint8_t cmd, uint8_t param, uint8_t len, uint8_t *status);
 
 bool ds2482_init(void)
 {
-    uint8_t cfg = DS2482_REG_CFG_APU;
-
     _g_devAddr = DS2482_DEV_ADDR;
 
     if (!ds2482_reset())
         return false;
 
+#ifdef _OW_DS2482_800_
+    _g_channel = 0;                     /* Device reset selects channel 0 */
+#endif /* _OW_DS2482_800_ */
+
+    if (!ds2482_write_config(DS2482_REG_CFG_APU))
+        return false;
+
+    return true;
+}
+
+static const uint8_t _g_ptr_data[] = {DS2482_CMD_SET_READ_PTR, DS2482_PTR_CODE_DATA};
+
+/*
+ * A 1-Wire command (len 1, or 2 with its parameter) followed by a
+ * status poll behind a repeated START, until the command is done.
+ * Every 1-Wire command leaves the read pointer on the status register.
+ */
+static void ds2482_cmd_xfer(i2c_xfer_t *xfer, const uint8_t *cmd, uint8_t len, uint8_t *status)
+{
+    xfer->addr = _g_devAddr;
+    xfer->wbuf = cmd;
+    xfer->wlen = len;
+    xfer->rbuf = status;
+    xfer->rlen = DS2482_WAIT_CYCLES;
+    xfer->poll_mask = DS2482_REG_STATUS_1WB;
+    xfer->next = NULL;
+}
+
+/* Moves the read pointer to the data register and reads it */
+static void ds2482_data_xfer(i2c_xfer_t *xfer, uint8_t *data)
+{
+    xfer->addr = _g_devAddr;
+    xfer->wbuf = _g_ptr_data;
+    xfer->wlen = sizeof(_g_ptr_data);
+    xfer->rbuf = data;
+    xfer->rlen = 1;
+    xfer->poll_mask = 0;
+    xfer->next = NULL;
+}
+
+static bool ds2482_exec(uint8_t cmd, uint8_t param, uint8_t len, uint8_t *status)
+{
+    uint8_t data[2];
+    i2c_xfer_t xfer;
+
+    data[0] = cmd;
+    data[1] = param;
+
+    ds2482_cmd_xfer(&xfer, data, len, status);
+    return i2c_transfer(&xfer);
+}
+
+static bool ds2482_write_config(uint8_t cfg)
+{
     if (!i2c_write(_g_devAddr, DS2482_CMD_WRITE_CONFIG, (cfg) | (~cfg) << 4))
         return false;
 
+    _g_devCfg = cfg;
     return true;
 }
 
+#ifdef _OW_OVERDRIVE_
+
+/*
+ * 1WS applies to every 1-Wire command including the reset, so it must
+ * be clear again before the standard speed reset that ends overdrive.
+ */
+static bool ds2482_set_speed(bool overdrive)
+{
+    uint8_t cfg = overdrive ? (_g_devCfg | DS2482_REG_CFG_1WS) : (_g_devCfg & ~DS2482_REG_CFG_1WS);
+
+    if (cfg == _g_devCfg)
+        return true;
+
+    return ds2482_write_config(cfg);
+}
+
+#define DS2482_SPEED_STD() ds2482_set_speed(false)
+
+#else
+
+#define DS2482_SPEED_STD() true
+
+#endif /* _OW_OVERDRIVE_ */
+
 static bool ds2482_reset(void)
 {
     uint8_t status;
@@ -117,10 +205,7 @@ bool ds2482_bus_reset(bool *presense_detect)
 
     *presense_detect = true;
 
-    if (!i2c_write_byte(_g_devAddr, DS2482_CMD_1WIRE_RESET))
-        return false;
-
-    if (!i2c_await_flag(_g_devAddr, DS2482_REG_STATUS_1WB, &status, DS2482_WAIT_CYCLES))
+    if (!ds2482_exec(DS2482_CMD_1WIRE_RESET, 0, 1, &status))
         return false;
 
     /* Check for short condition */
@@ -139,6 +224,9 @@ bool ds2482_select(const uint8_t *id)
     uint8_t i;
     bool presense;
 
+    if (!DS2482_SPEED_STD())
+        return false;
+
     if (!ds2482_bus_reset(&presense))
         return false;
     if (!presense)
@@ -165,6 +253,47 @@ bool ds2482_select(const uint8_t *id)
     return true;
 }
 
+#ifdef _OW_OVERDRIVE_
+
+/*
+ * As ds2482_select(), but the addressed device(s) and the DS2482 both
+ * switch to overdrive after the ROM command.
+ */
+bool ds2482_select_od(const uint8_t *id)
+{
+    uint8_t i;
+    bool presense;
+
+    if (!ds2482_set_speed(false))
+        return false;
+
+    if (!ds2482_bus_reset(&presense))
+        return false;
+    if (!presense)
+        return false;
+
+    if (!ds2482_write_byte(id ? OW_OD_MATCH_ROM : OW_OD_SKIP_ROM))
+        return false;
+
+    if (!ds2482_set_speed(true))
+        return false;
+
+    if (id)
+    {
+        i = OW_ROMCODE_SIZE;
+        do
+        {
+            if (!ds2482_write_byte(*id))
+                return false;
+            id++;
+        } while (--i);
+    }
+
+    return true;
+}
+
+#endif /* _OW_OVERDRIVE_ */
+
 bool ds2482_write(const uint8_t *data, uint8_t len)
 {
     while (len--)
@@ -176,22 +305,21 @@ bool ds2482_write(const uint8_t *data, uint8_t len)
     return true;
 }
 
+/* One I2C transaction per byte: command, status poll, pointer to data, data */
 bool ds2482_read(uint8_t *buf, uint8_t len)
 {
+    static const uint8_t cmd = DS2482_CMD_1WIRE_READ_BYTE;
+    i2c_xfer_t poll;
+    i2c_xfer_t data;
     uint8_t status;
 
     while (len--)
     {
-        if (!i2c_write_byte(_g_devAddr, DS2482_CMD_1WIRE_READ_BYTE))
-            return false;
+        ds2482_cmd_xfer(&poll, &cmd, 1, &status);
+        ds2482_data_xfer(&data, buf++);
+        poll.next = &data;
 
-        if (!i2c_await_flag(_g_devAddr, DS2482_REG_STATUS_1WB, &status, DS2482_WAIT_CYCLES))
-            return false;
-
-        if (!i2c_write(_g_devAddr, DS2482_CMD_SET_READ_PTR, DS2482_PTR_CODE_DATA))
-            return false;
-
-        if (!i2c_read_byte(_g_devAddr, buf++))
+        if (!i2c_transfer(&poll))
             return false;
     }
 
@@ -202,33 +330,18 @@ static bool ds2482_write_byte(const uint8_t data)
 {
     uint8_t status;
 
-    if (!i2c_write(_g_devAddr, DS2482_CMD_1WIRE_WRITE_BYTE, data))
-        return false;
-
-    if (!i2c_await_flag(_g_devAddr, DS2482_REG_STATUS_1WB, &status, DS2482_WAIT_CYCLES))
-        return false;
-
-    return true;
+    return ds2482_exec(DS2482_CMD_1WIRE_WRITE_BYTE, data, 2, &status);
 }
 
 bool ds2482_bit_io(bool *bit)
 {
     uint8_t status;
-    uint8_t data;
 
-    if (!i2c_write(_g_devAddr, DS2482_CMD_1WIRE_SINGLE_BIT, *bit ? 0x80 : 0x00))
+    if (!ds2482_exec(DS2482_CMD_1WIRE_SINGLE_BIT, *bit ? 0x80 : 0x00, 2, &status))
         return false;
 
-    if (!i2c_await_flag(_g_devAddr, DS2482_REG_STATUS_1WB, &status, DS2482_WAIT_CYCLES))
-        return false;
-
-    if (!i2c_read_byte(_g_devAddr, &data))
-        return false;
-
-    if (data & 0x80)
-        *bit = true;
-    else
-        *bit = false;
+    /* The result is in the status byte that ended the poll */
+    *bit = (status & DS2482_REG_STATUS_SBR) ? true : false;
 
     return true;
 }
@@ -241,6 +354,8 @@ uint8_t ds2482_rom_search(uint8_t diff, uint8_t *id)
     uint8_t next_diff;
     bool presense;
 
+    if (!DS2482_SPEED_STD())
+        return OW_COMMS_ERR;
     if (!ds2482_bus_reset(&presense))
         return OW_COMMS_ERR;
     if (!presense)
@@ -262,10 +377,7 @@ uint8_t ds2482_rom_search(uint8_t diff, uint8_t *id)
             if (diff > i || ((*id & 1) && diff != i)) /* Use '1' on this pass */
                 search_direction = DS2482_CMD_1WIRE_TRIPLET_DIR;
 
-            if (!i2c_write(_g_devAddr, DS2482_CMD_1WIRE_TRIPLET, search_direction))
-                return OW_COMMS_ERR;
-
-            if (!i2c_await_flag(_g_devAddr, DS2482_REG_STATUS_1WB, &status, DS2482_WAIT_CYCLES))
+            if (!ds2482_exec(DS2482_CMD_1WIRE_TRIPLET, search_direction, 2, &status))
                 return OW_COMMS_ERR;
 
             if ((status & DS2482_REG_STATUS_SBR) && (status & DS2482_REG_STATUS_TSB))
@@ -291,16 +403,172 @@ uint8_t ds2482_rom_search(uint8_t diff, uint8_t *id)
     return next_diff; /* To continue search */
 }
 
+#ifdef _OW_ASYNC_
+
+/*
+ * The ow_async.h interface on the DS2482. Each 1-Wire byte is one queued
+ * I2C transaction (command, then status poll), and its completion
+ * callback queues the next, so the whole readout runs from the TWI
+ * interrupt.
+ */
+
+#define OWA_MAX_TX           (1 + OW_ROMCODE_SIZE + OWASYNC_MAX_WRITE)
+
+static volatile bool _g_owa_busy;
+static volatile bool _g_owa_ok;
+static uint8_t _g_owa_tx[OWA_MAX_TX];
+static uint8_t _g_owa_txlen;
+static uint8_t *_g_owa_rbuf;
+static uint8_t _g_owa_rlen;
+static uint8_t _g_owa_pos;               /* Byte being clocked. Writes, then reads */
+static uint8_t _g_owa_cmd[2];
+static uint8_t _g_owa_status;
+static i2c_xfer_t _g_owa_poll;
+static i2c_xfer_t _g_owa_data;
+
+static void owasync_finish(bool ok)
+{
+    _g_owa_ok = ok;
+    _g_owa_busy = false;
+}
+
+/* Queues the next byte, or finishes after the last one */
+static void owasync_next(void)
+{
+    if (_g_owa_pos == _g_owa_txlen + _g_owa_rlen)
+    {
+        owasync_finish(true);
+        return;
+    }
+
+    if (_g_owa_pos < _g_owa_txlen)
+    {
+        _g_owa_cmd[0] = DS2482_CMD_1WIRE_WRITE_BYTE;
+        _g_owa_cmd[1] = _g_owa_tx[_g_owa_pos];
+        ds2482_cmd_xfer(&_g_owa_poll, _g_owa_cmd, 2, &_g_owa_status);
+    }
+    else
+    {
+        _g_owa_cmd[0] = DS2482_CMD_1WIRE_READ_BYTE;
+        ds2482_cmd_xfer(&_g_owa_poll, _g_owa_cmd, 1, &_g_owa_status);
+        ds2482_data_xfer(&_g_owa_data, &_g_owa_rbuf[_g_owa_pos - _g_owa_txlen]);
+        _g_owa_poll.next = &_g_owa_data;
+    }
+
+    _g_owa_pos++;
+
+    if (!i2c_submit(&_g_owa_poll))
+        owasync_finish(false);
+}
+
+/* Completion callback, from the TWI interrupt */
+static void owasync_done(i2c_xfer_t *xfer)
+{
+    if (xfer->state != I2C_XFER_DONE)
+    {
+        owasync_finish(false);
+        return;
+    }
+
+    /* Only the reset has a presence pulse to check */
+    if (_g_owa_cmd[0] == DS2482_CMD_1WIRE_RESET &&
+            (_g_owa_status & (DS2482_REG_STATUS_PPD | DS2482_REG_STATUS_SD)) != DS2482_REG_STATUS_PPD)
+    {
+        owasync_finish(false);
+        return;
+    }
+
+    owasync_next();
+}
+
+bool owasync_start(const uint8_t *id, const uint8_t *data, uint8_t wlen, uint8_t *rbuf, uint8_t rlen)
+{
+    if (_g_owa_busy || wlen > OWASYNC_MAX_WRITE)
+        return false;
+
+    if (!DS2482_SPEED_STD())
+        return false;
+
+    _g_owa_txlen = 0;
+
+    if (id)
+    {
+        _g_owa_tx[_g_owa_txlen++] = OW_MATCH_ROM;
+        memcpy(&_g_owa_tx[_g_owa_txlen], id, OW_ROMCODE_SIZE);
+        _g_owa_txlen += OW_ROMCODE_SIZE;
+    }
+    else
+    {
+        _g_owa_tx[_g_owa_txlen++] = OW_SKIP_ROM;
+    }
+
+    memcpy(&_g_owa_tx[_g_owa_txlen], data, wlen);
+    _g_owa_txlen += wlen;
+
+    memset(rbuf, 0, rlen);
+    _g_owa_rbuf = rbuf;
+    _g_owa_rlen = rlen;
+    _g_owa_pos = 0;
+    _g_owa_ok = false;
+
+    _g_owa_cmd[0] = DS2482_CMD_1WIRE_RESET;
+    ds2482_cmd_xfer(&_g_owa_poll, _g_owa_cmd, 1, &_g_owa_status);
+    _g_owa_poll.done = owasync_done;
+
+    _g_owa_busy = true;
+
+    if (!i2c_submit(&_g_owa_poll))
+    {
+        _g_owa_busy = false;
+        return false;
+    }
+
+    return true;
+}
+
+bool owasync_busy(void)
+{
+    /* i2c_abort() fails the queue without calling back */
+    if (_g_owa_busy && _g_owa_poll.state == I2C_XFER_FAILED)
+        owasync_finish(false);
+
+    return _g_owa_busy;
+}
+
+bool owasync_result(void)
+{
+    return _g_owa_ok;
+}
+
+#endif /* _OW_ASYNC_ */
+
 #ifdef _OW_DS2482_800_
 
+/*
+ * Selecting the channel that's already selected costs nothing, so
+ * callers can do it before every transaction.
+ */
 bool ds2482_select_channel(uint8_t channel)
 {
-    if (channel >= 8)
+    uint8_t check;
+
+    if (channel >= DS2482_CHANNELS)
         return false;
 
+    if (channel == _g_channel)
+        return true;
+
     if (!i2c_write(_g_devAddr, DS2482_CMD_CHANNEL_SELECT, ds2482_chan_wr[channel]))
         return false;
 
+    /* The read pointer is left on the channel selection register */
+    if (!i2c_read_byte(_g_devAddr, &check) || check != ds2482_chan_rd[channel])
+    {
+        _g_channel = DS2482_CHANNELS;   /* Unknown. Select again next time */
+        return false;
+    }
+
+    _g_channel = channel;
     return true;
 }
 
@@ -19,12 +19,18 @@
 #ifndef __DS2482_H__
 #define	__DS2482_H__
 
+#define DS2482_CHANNELS 8               /* DS2482-800 */
+
 bool ds2482_init(void);
 bool ds2482_bus_reset(bool *presense_detect);
 bool ds2482_select(const uint8_t *id);
+bool ds2482_select_od(const uint8_t *id);
 bool ds2482_read(uint8_t *buf, uint8_t len);
 bool ds2482_write(const uint8_t *data, uint8_t len);
 bool ds2482_bit_io(bool *bit);
 uint8_t ds2482_rom_search(uint8_t diff, uint8_t *id);
+#ifdef _OW_DS2482_800_
+bool ds2482_select_channel(uint8_t channel);
+#endif /* _OW_DS2482_800_ */
 
 #endif /* __DS2482_H__ */
\ No newline at end of file
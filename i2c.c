@@ -27,7 +27,11 @@
 #include <avr/io.h>
 #include <util/twi.h>
 #include <util/delay.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 
+#include "iopins.h"
+#include "util.h"
 #include "i2c.h"
 
 #define I2C_PRESCALER 1
@@ -36,12 +40,114 @@
 
 #ifdef _I2C_
 
+#ifdef _I2C_BRUTEFORCE_RESET_
+#define I2C_RECOVERY_CLOCKS 9
+#define I2C_RECOVERY_HALF   5       /* usec. 100KHz */
+#endif /* _I2C_BRUTEFORCE_RESET_ */
+
+static i2c_stats_t _g_stats;
+
+/* Saturates rather than wrapping back to 0 */
+static void i2c_count(uint16_t *counter)
+{
+    if (*counter != 0xFFFF)
+        (*counter)++;
+}
+
 void i2c_init(uint16_t freq_khz)
 {
     TWSR = 0;
 	TWBR = (uint8_t)((((F_CPU / freq_khz * 1000) / I2C_PRESCALER) - 16) / 2);
+#ifdef _I2C_BRUTEFORCE_RESET_
+    /* A reset part way through a read can leave a slave holding SDA */
+    if (IO_IN_LOW(SDA))
+        i2c_bruteforce_reset();
+#endif /* _I2C_BRUTEFORCE_RESET_ */
+#ifdef _I2C_ASYNC_
+    TWCR = _BV(TWEN);
+#endif /* _I2C_ASYNC_ */
 }
 
+#ifdef _I2C_BRUTEFORCE_RESET_
+
+/*
+ * A slave that lost track of the transaction holds SDA low while it
+ * waits to clock out the rest of a byte. Takes the pins off the TWI and
+ * clocks SCL until it lets go (9 clocks covers a byte and its ACK), then
+ * sends a STOP so every slave sees the bus as free.
+ */
+void i2c_bruteforce_reset(void)
+{
+    uint8_t twcr = TWCR;
+    uint8_t i;
+
+    TWCR = 0;
+
+    /* Both lines released with the pull-ups, SCL driven low as needed */
+    IO_INPUT(SDA);
+    IO_HIGH(SDA);
+    IO_INPUT(SCL);
+    IO_HIGH(SCL);
+    _delay_us(I2C_RECOVERY_HALF);
+
+    for (i = 0; i < I2C_RECOVERY_CLOCKS && IO_IN_LOW(SDA); i++)
+    {
+        IO_LOW(SCL);
+        IO_OUTPUT(SCL);
+        _delay_us(I2C_RECOVERY_HALF);
+        IO_INPUT(SCL);
+        IO_HIGH(SCL);
+        _delay_us(I2C_RECOVERY_HALF);
+    }
+
+    /* STOP. SDA rising while SCL is high */
+    IO_LOW(SCL);
+    IO_OUTPUT(SCL);
+    IO_LOW(SDA);
+    IO_OUTPUT(SDA);
+    _delay_us(I2C_RECOVERY_HALF);
+    IO_INPUT(SCL);
+    IO_HIGH(SCL);
+    _delay_us(I2C_RECOVERY_HALF);
+    IO_INPUT(SDA);
+    IO_HIGH(SDA);
+    _delay_us(I2C_RECOVERY_HALF);
+
+    TWCR = twcr & (_BV(TWEN) | _BV(TWIE) | _BV(TWEA));
+    i2c_count(&_g_stats.recoveries);
+}
+
+#endif /* _I2C_BRUTEFORCE_RESET_ */
+
+/* Copy of the error counters, consistent even with the ISR counting */
+void i2c_get_stats(i2c_stats_t *stats)
+{
+    uint8_t intsave;
+
+    intsave = (SREG & _BV(SREG_I)) == _BV(SREG_I);
+    g_irq_disable();
+
+    *stats = _g_stats;
+
+    if (intsave)
+        g_irq_enable();
+}
+
+void i2c_print_stats(void)
+{
+    i2c_stats_t stats;
+
+    i2c_get_stats(&stats);
+
+    printf("I2C timeouts ..................: %u\r\n", stats.timeouts);
+    printf("I2C address NACKs .............: %u\r\n", stats.addr_nacks);
+    printf("I2C data NACKs ................: %u\r\n", stats.data_nacks);
+    printf("I2C bus errors ................: %u\r\n", stats.bus_errors);
+    printf("I2C bus recoveries ............: %u\r\n", stats.recoveries);
+}
+
+#ifndef _I2C_ASYNC_
+
 bool i2c_sync(void)
 {
     uint16_t timeout = 500;
@@ -51,7 +157,17 @@ bool i2c_sync(void)
         _delay_us(1);
         timeout--;
     }
-    return (timeout != 0);
+
+    if (!timeout)
+    {
+        i2c_count(&_g_stats.timeouts);
+#ifdef _I2C_BRUTEFORCE_RESET_
+        i2c_bruteforce_reset();
+#endif /* _I2C_BRUTEFORCE_RESET_ */
+        return false;
+    }
+
+    return true;
 }
 
 uint8_t i2c_wait_stop(void)
@@ -66,7 +182,16 @@ uint8_t i2c_wait_stop(void)
         timeout--;
     }
 
-    return (timeout != 0);
+    if (!timeout)
+    {
+        i2c_count(&_g_stats.timeouts);
+#ifdef _I2C_BRUTEFORCE_RESET_
+        i2c_bruteforce_reset();
+#endif /* _I2C_BRUTEFORCE_RESET_ */
+        return false;
+    }
+
+    return true;
 }
 
 uint8_t i2c_start_wait(uint8_t addr)
@@ -86,7 +211,20 @@ uint8_t i2c_start_wait(uint8_t addr)
         // check value of TWI Status Register. Mask prescaler bits.
         twst = TW_STATUS & 0xF8;
         if ((twst != TW_START) && (twst != TW_REP_START))
+        {
+            /* Bus error or arbitration lost. Don't spin on a bus that stays that way */
+            i2c_count(&_g_stats.bus_errors);
+
+            if (!(retry--))
+            {
+#ifdef _I2C_BRUTEFORCE_RESET_
+                i2c_bruteforce_reset();
+#endif /* _I2C_BRUTEFORCE_RESET_ */
+                break;
+            }
+
             continue;
+        }
 
         // send device address
         TWDR = addr;
@@ -98,14 +236,16 @@ uint8_t i2c_start_wait(uint8_t addr)
 
         // check value of TWI Status Register. Mask prescaler bits.
         twst = TW_STATUS & 0xF8;
-        if ((twst == TW_MT_SLA_NACK) || (twst == TW_MR_DATA_NACK))
+        if ((twst == TW_MT_SLA_NACK) || (twst == TW_MR_SLA_NACK))
         {
             /* device busy, send stop condition to terminate write operation */
-            if (!i2c_wait_stop())
-                continue;
+            i2c_wait_stop();    /* Recovers the bus itself if this times out */
 
             if (!(retry--))
+            {
+                i2c_count(&_g_stats.addr_nacks);
                 break;
+            }
 
             continue;
         }
@@ -131,7 +271,10 @@ static bool i2c_byte_out(uint8_t data)
     // check value of TWI Status Register. Mask prescaler bits
     twst = TW_STATUS & 0xF8;
     if (twst != TW_MT_DATA_ACK)
+    {
+        i2c_count(&_g_stats.data_nacks);
         return false;
+    }
 
     return true;
 }
@@ -329,9 +472,61 @@ fail:
 
 #endif /* _I2C_XFER_X16_ */
 
-#ifdef _I2C_DS2482_SPECIAL_
+#ifdef _I2C_XFER_RS_
 
-bool i2c_await_flag(uint8_t addr, uint8_t mask, uint8_t *ret, uint8_t attempts)
+/*
+ * Pieces of a combined transaction. Each one begins with a START, which
+ * goes out as a repeated START if the bus is already ours, and none of
+ * them finish with a STOP. Call i2c_stop() once the whole sequence is
+ * done. On failure the STOP has already been sent.
+ */
+
+bool i2c_rs_write(uint8_t addr, const uint8_t *data, uint8_t len)
+{
+    if (!i2c_start_wait((addr << 1) | I2C_WRITE))
+        goto fail;
+
+    while (len--)
+    {
+        if (!i2c_byte_out(*data++))
+            goto fail;
+    }
+
+    return true;
+fail:
+    i2c_wait_stop();
+    return false;
+}
+
+bool i2c_rs_read(uint8_t addr, uint8_t *data, uint8_t len)
+{
+    if (!i2c_start_wait((addr << 1) | I2C_READ))
+        goto fail;
+
+    while (len > 1)
+    {
+        if (!i2c_read_ack(data++))
+            goto fail;
+
+        len--;
+    }
+
+    if (!i2c_read_nack(data))
+        goto fail;
+
+    return true;
+fail:
+    i2c_wait_stop();
+    return false;
+}
+
+bool i2c_stop(void)
+{
+    return i2c_wait_stop();
+}
+
+/* Reads until (status & mask) == 0, up to attempts times */
+bool i2c_rs_await_flag(uint8_t addr, uint8_t mask, uint8_t *ret, uint8_t attempts)
 {
     uint8_t status;
 
@@ -350,15 +545,406 @@ bool i2c_await_flag(uint8_t addr, uint8_t mask, uint8_t *ret, uint8_t attempts)
     if (!i2c_read_nack(&status))
         goto fail;
 
-    i2c_wait_stop();
     *ret = status;
-    return !(status & mask);
 
+    if (status & mask)
+        goto fail;
+
+    return true;
 fail:
     i2c_wait_stop();
     return false;
 }
 
+/* Runs a descriptor chain as one transaction. See i2c_xfer_t */
+bool i2c_transfer(i2c_xfer_t *xfer)
+{
+    for (; xfer; xfer = xfer->next)
+    {
+        if (xfer->wlen && !i2c_rs_write(xfer->addr, xfer->wbuf, xfer->wlen))
+            return false;
+
+        if (xfer->poll_mask)
+        {
+            if (!i2c_rs_await_flag(xfer->addr, xfer->poll_mask, xfer->rbuf, xfer->rlen))
+                return false;
+        }
+        else if (xfer->rlen)
+        {
+            if (!i2c_rs_read(xfer->addr, xfer->rbuf, xfer->rlen))
+                return false;
+        }
+    }
+
+    return i2c_stop();
+}
+
+#endif /* _I2C_XFER_RS_ */
+
+#ifdef _I2C_DS2482_SPECIAL_
+
+#ifndef _I2C_XFER_RS_
+#error "_I2C_DS2482_SPECIAL_ needs _I2C_XFER_RS_ or _I2C_ASYNC_"
+#endif
+
+bool i2c_await_flag(uint8_t addr, uint8_t mask, uint8_t *ret, uint8_t attempts)
+{
+    if (!i2c_rs_await_flag(addr, mask, ret, attempts))
+        return false;
+
+    return i2c_wait_stop();
+}
+
 #endif /* _I2C_DS2482_SPECIAL_ */
 
+#else
+
+/*
+ * Interrupt driven master. Transactions are queued as descriptors and
+ * clocked from the TWI interrupt, so nothing spins on TWINT. The
+ * blocking calls are still there for callers that want the result
+ * straight away. They queue a descriptor and wait for it.
+ */
+
+#if defined(_I2C_XFER_MANY_) || defined(_I2C_XFER_RS_)
+#error "_I2C_ASYNC_ only provides _I2C_XFER_, _I2C_XFER_BYTE_, _I2C_XFER_X16_ and _I2C_DS2482_SPECIAL_"
+#endif
+
+#define I2C_QUEUE_LEN       4
+#define I2C_RETRIES         100     /* Address NACKs before giving up, as i2c_start_wait() */
+#define I2C_TIMEOUT_MS      25      /* Blocking calls only */
+
+#define I2C_TWCR_GO         (_BV(TWINT) | _BV(TWEN) | _BV(TWIE))
+
+static i2c_xfer_t *_g_queue[I2C_QUEUE_LEN];
+static volatile uint8_t _g_qhead;
+static volatile uint8_t _g_qcount;
+static volatile bool _g_busy;
+static i2c_xfer_t *_g_seg;              /* Segment being clocked */
+static uint8_t _g_idx;                  /* Bytes written or read, or status reads when polling */
+static uint8_t _g_tries;
+static bool _g_reading;
+
+static void i2c_seg_begin(i2c_xfer_t *seg)
+{
+    _g_seg = seg;
+    _g_idx = 0;
+    _g_tries = I2C_RETRIES;
+    _g_reading = (seg->wlen == 0 && seg->rlen != 0);
+}
+
+/* Called from the ISR. The next transaction goes straight out after the STOP */
+static void i2c_finish(bool ok)
+{
+    i2c_xfer_t *xfer = _g_queue[_g_qhead];
+
+    _g_qhead = (_g_qhead + 1) % I2C_QUEUE_LEN;
+    _g_qcount--;
+
+    xfer->state = ok ? I2C_XFER_DONE : I2C_XFER_FAILED;
+
+    /* May queue more */
+    if (xfer->done)
+        xfer->done(xfer);
+
+    if (_g_qcount)
+    {
+        i2c_seg_begin(_g_queue[_g_qhead]);
+        TWCR = I2C_TWCR_GO | _BV(TWSTO) | _BV(TWSTA);
+    }
+    else
+    {
+        _g_busy = false;
+        TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+    }
+}
+
+static void i2c_seg_end(bool ok)
+{
+    if (ok && _g_seg->next)
+    {
+        i2c_seg_begin(_g_seg->next);
+        TWCR = I2C_TWCR_GO | _BV(TWSTA);   /* Repeated START */
+        return;
+    }
+
+    i2c_finish(ok);
+}
+
+/* Whether the byte about to be received gets an ACK */
+static bool i2c_ack_next(void)
+{
+    if (_g_seg->poll_mask)
+        return true;
+
+    return (_g_idx + 1) < _g_seg->rlen;
+}
+
+/*
+ * Queues a transaction. xfer must stay valid until its state leaves
+ * I2C_XFER_QUEUED. Returns false if the queue is full. Safe to call
+ * from a completion callback.
+ */
+bool i2c_submit(i2c_xfer_t *xfer)
+{
+    uint8_t intsave;
+    bool ret = false;
+
+    xfer->state = I2C_XFER_QUEUED;
+
+    intsave = (SREG & _BV(SREG_I)) == _BV(SREG_I);
+    g_irq_disable();
+
+    if (_g_qcount < I2C_QUEUE_LEN)
+    {
+        _g_queue[(_g_qhead + _g_qcount) % I2C_QUEUE_LEN] = xfer;
+        _g_qcount++;
+        ret = true;
+
+        if (!_g_busy)
+        {
+            _g_busy = true;
+            i2c_seg_begin(xfer);
+
+            /* The last STOP may still be going out */
+            while (TWCR & _BV(TWSTO));
+
+            TWCR = I2C_TWCR_GO | _BV(TWSTA);
+        }
+    }
+
+    if (intsave)
+        g_irq_enable();
+
+    return ret;
+}
+
+/* Throws away everything queued and resets the TWI */
+static void i2c_abort(void)
+{
+    uint8_t intsave;
+
+    intsave = (SREG & _BV(SREG_I)) == _BV(SREG_I);
+    g_irq_disable();
+
+    TWCR = 0;
+
+    while (_g_qcount)
+    {
+        _g_queue[_g_qhead]->state = I2C_XFER_FAILED;
+        _g_qhead = (_g_qhead + 1) % I2C_QUEUE_LEN;
+        _g_qcount--;
+    }
+
+    _g_busy = false;
+    TWCR = _BV(TWEN);
+
+    if (intsave)
+        g_irq_enable();
+}
+
+/* Queue and wait. The ISR carries on with anything queued before it */
+bool i2c_transfer(i2c_xfer_t *xfer)
+{
+    uint16_t timeout = I2C_TIMEOUT_MS * 100;
+
+    xfer->done = NULL;
+
+    if (!i2c_submit(xfer))
+        return false;
+
+    while (xfer->state == I2C_XFER_QUEUED)
+    {
+        if (!timeout--)
+        {
+            i2c_count(&_g_stats.timeouts);
+            i2c_abort();
+#ifdef _I2C_BRUTEFORCE_RESET_
+            i2c_bruteforce_reset();
+#endif /* _I2C_BRUTEFORCE_RESET_ */
+            return false;
+        }
+
+        _delay_us(10);
+    }
+
+    return xfer->state == I2C_XFER_DONE;
+}
+
+ISR(TWI_vect)
+{
+    i2c_xfer_t *seg = _g_seg;
+    uint8_t data;
+
+    switch (TW_STATUS)
+    {
+    case TW_START:
+    case TW_REP_START:
+        TWDR = (seg->addr << 1) | (_g_reading ? I2C_READ : I2C_WRITE);
+        TWCR = I2C_TWCR_GO;
+        break;
+
+    case TW_MT_SLA_ACK:
+    case TW_MT_DATA_ACK:
+        if (_g_idx < seg->wlen)
+        {
+            TWDR = seg->wbuf[_g_idx++];
+            TWCR = I2C_TWCR_GO;
+        }
+        else if (seg->rlen)
+        {
+            _g_reading = true;
+            _g_idx = 0;
+            TWCR = I2C_TWCR_GO | _BV(TWSTA);
+        }
+        else
+        {
+            i2c_seg_end(true);
+        }
+        break;
+
+    case TW_MT_SLA_NACK:
+    case TW_MR_SLA_NACK:
+        /* Device busy. Go again, as the polled driver does */
+        if (_g_tries--)
+        {
+            _g_idx = 0;
+            _g_reading = (seg->wlen == 0 && seg->rlen != 0);
+            TWCR = I2C_TWCR_GO | _BV(TWSTO) | _BV(TWSTA);
+        }
+        else
+        {
+            i2c_count(&_g_stats.addr_nacks);
+            i2c_finish(false);
+        }
+        break;
+
+    case TW_MT_DATA_NACK:
+        i2c_count(&_g_stats.data_nacks);
+        i2c_finish(false);
+        break;
+
+    case TW_MR_SLA_ACK:
+        _g_idx = 0;
+        TWCR = I2C_TWCR_GO | (i2c_ack_next() ? _BV(TWEA) : 0);
+        break;
+
+    case TW_MR_DATA_ACK:
+        data = TWDR;
+
+        if (seg->poll_mask)
+        {
+            /* Once clear (or out of tries), one more read with NACK to finish */
+            if (!(data & seg->poll_mask) || ++_g_idx >= seg->rlen)
+            {
+                TWCR = I2C_TWCR_GO;
+                break;
+            }
+        }
+        else
+        {
+            seg->rbuf[_g_idx++] = data;
+        }
+
+        TWCR = I2C_TWCR_GO | (i2c_ack_next() ? _BV(TWEA) : 0);
+        break;
+
+    case TW_MR_DATA_NACK:
+        data = TWDR;
+
+        if (seg->poll_mask)
+        {
+            seg->rbuf[0] = data;
+            i2c_seg_end(!(data & seg->poll_mask));
+        }
+        else
+        {
+            seg->rbuf[_g_idx++] = data;
+            i2c_seg_end(true);
+        }
+        break;
+
+    default:
+        /* Bus error or lost arbitration */
+        i2c_count(&_g_stats.bus_errors);
+        i2c_finish(false);
+        break;
+    }
+}
+
+#ifdef _I2C_XFER_
+
+bool i2c_read(uint8_t addr, uint8_t reg, uint8_t *ret)
+{
+    i2c_xfer_t xfer = {addr, &reg, 1, ret, 1, 0, NULL, NULL, 0};
+
+    return i2c_transfer(&xfer);
+}
+
+bool i2c_write(uint8_t addr, uint8_t reg, uint8_t data)
+{
+    uint8_t buf[2] = {reg, data};
+    i2c_xfer_t xfer = {addr, buf, 2, NULL, 0, 0, NULL, NULL, 0};
+
+    return i2c_transfer(&xfer);
+}
+
+#endif /* _I2C_XFER_ */
+
+#ifdef _I2C_XFER_BYTE_
+
+bool i2c_read_byte(uint8_t addr, uint8_t *ret)
+{
+    i2c_xfer_t xfer = {addr, NULL, 0, ret, 1, 0, NULL, NULL, 0};
+
+    return i2c_transfer(&xfer);
+}
+
+bool i2c_write_byte(uint8_t addr, uint8_t data)
+{
+    i2c_xfer_t xfer = {addr, &data, 1, NULL, 0, 0, NULL, NULL, 0};
+
+    return i2c_transfer(&xfer);
+}
+
+#endif /* _I2C_XFER_BYTE_ */
+
+#ifdef _I2C_XFER_X16_
+
+/* MSB first on the wire, as the polled versions */
+bool i2c_read16(uint8_t addr, uint8_t reg, uint16_t *ret)
+{
+    uint8_t buf[2];
+    i2c_xfer_t xfer = {addr, &reg, 1, buf, 2, 0, NULL, NULL, 0};
+
+    if (!i2c_transfer(&xfer))
+        return false;
+
+    *ret = ((uint16_t)buf[0] << 8) | buf[1];
+    return true;
+}
+
+bool i2c_write16(uint8_t addr, uint8_t reg, uint16_t data)
+{
+    uint8_t buf[3] = {reg, data >> 8, data};
+    i2c_xfer_t xfer = {addr, buf, 3, NULL, 0, 0, NULL, NULL, 0};
+
+    return i2c_transfer(&xfer);
+}
+
+#endif /* _I2C_XFER_X16_ */
+
+#ifdef _I2C_DS2482_SPECIAL_
+
+bool i2c_await_flag(uint8_t addr, uint8_t mask, uint8_t *ret, uint8_t attempts)
+{
+    i2c_xfer_t xfer = {addr, NULL, 0, ret, attempts, mask, NULL, NULL, 0};
+
+    return i2c_transfer(&xfer);
+}
+
+#endif /* _I2C_DS2482_SPECIAL_ */
+
+#endif /* _I2C_ASYNC_ */
+
 #endif /* _I2C_ */
\ No newline at end of file
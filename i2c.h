@@ -21,7 +21,45 @@
 #ifndef __I2C_H__
 #define __I2C_H__
 
+#include <stdint.h>
+#include <stdbool.h>
+
+#define I2C_XFER_IDLE       0
+#define I2C_XFER_QUEUED     1
+#define I2C_XFER_DONE       2
+#define I2C_XFER_FAILED     3
+
+/*
+ * One transaction: write wlen bytes, then read rlen bytes, either part
+ * optional. With poll_mask set, the read part instead reads a status
+ * byte until (status & poll_mask) == 0, up to rlen times, and leaves
+ * the last one in rbuf[0]. If next is set the transaction carries on
+ * with it after a repeated START rather than a STOP.
+ */
+typedef struct i2c_xfer {
+    uint8_t addr;
+    const uint8_t *wbuf;
+    uint8_t wlen;
+    uint8_t *rbuf;
+    uint8_t rlen;
+    uint8_t poll_mask;
+    struct i2c_xfer *next;
+    void (*done)(struct i2c_xfer *xfer);    /* _I2C_ASYNC_ only. Runs in the ISR */
+    volatile uint8_t state;
+} i2c_xfer_t;
+
+/* Error counters. Saturate at 65535 */
+typedef struct {
+    uint16_t timeouts;      /* TWI never finished. Bus stuck */
+    uint16_t addr_nacks;    /* No answer after every retry */
+    uint16_t data_nacks;
+    uint16_t bus_errors;    /* Bus error, lost arbitration, START not sent */
+    uint16_t recoveries;    /* i2c_bruteforce_reset() runs */
+} i2c_stats_t;
+
 void i2c_init(uint16_t freq_khz);
+void i2c_get_stats(i2c_stats_t *stats);
+void i2c_print_stats(void);
 
 #ifdef _I2C_BRUTEFORCE_RESET_
 void i2c_bruteforce_reset(void);
@@ -51,6 +89,21 @@ bool i2c_read16(uint8_t addr, uint8_t reg, uint16_t *ret);
 bool i2c_write16(uint8_t addr, uint8_t reg, uint16_t data);
 #endif /* _I2C_XFER_X16_ */
 
+#ifdef _I2C_XFER_RS_
+bool i2c_rs_write(uint8_t addr, const uint8_t *data, uint8_t len);
+bool i2c_rs_read(uint8_t addr, uint8_t *data, uint8_t len);
+bool i2c_rs_await_flag(uint8_t addr, uint8_t mask, uint8_t *ret, uint8_t attempts);
+bool i2c_stop(void);
+#endif /* _I2C_XFER_RS_ */
+
+#if defined(_I2C_XFER_RS_) || defined(_I2C_ASYNC_)
+bool i2c_transfer(i2c_xfer_t *xfer);
+#endif /* _I2C_XFER_RS_ || _I2C_ASYNC_ */
+
+#ifdef _I2C_ASYNC_
+bool i2c_submit(i2c_xfer_t *xfer);
+#endif /* _I2C_ASYNC_ */
+
 #ifdef _I2C_DS2482_SPECIAL_
 bool i2c_await_flag(uint8_t addr, uint8_t mask, uint8_t *ret, uint8_t attempts);
 #endif /* _I2C_DS2482_SPECIAL_ */
@@ -0,0 +1,147 @@
+/*
+ *   File:   i2ctemp.c
+ *   Author: Matthew Millman
+ *
+ *   Fan speed controller. OSS AVR Version.
+ *
+ *   LM75, TMP102 and MCP9808 class I2C temperature sensors
+ *
+ *   Created on 17 October 2026, 18:20
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "i2c.h"
+#include "i2ctemp.h"
+
+#ifdef _I2C_TEMP_
+
+/*
+ * These sensors convert continuously from power up, so there's nothing
+ * to start. A reading is one register read of ~100us at 400KHz.
+ */
+
+/* LM75 class. 0.5 degree (LM75) to 0.0625 degree (TMP102) resolution,
+   always left justified in a 16 bit signed register */
+#define LM75_ADDR_FIRST      0x48
+#define LM75_ADDR_LAST       0x4F
+#define LM75_REG_TEMP        0x00
+
+#define MCP9808_ADDR_FIRST   0x18
+#define MCP9808_ADDR_LAST    0x1F
+#define MCP9808_REG_TEMP     0x05
+#define MCP9808_REG_MFR_ID   0x06
+#define MCP9808_REG_DEV_ID   0x07
+#define MCP9808_MFR_ID       0x0054
+#define MCP9808_DEV_ID       0x04    /* High byte. Low byte is the revision */
+
+#define I2CTEMP_MIN          -550    /* Same range as the DS18B20 */
+#define I2CTEMP_MAX          1250
+
+/* The DS2482 straps to 0x18 to 0x1B, in the middle of the MCP9808 range */
+#ifdef _OW_DS2482_
+#define MCP9808_ADDR_SKIP(a) ((a) <= 0x1B)
+#else
+#define MCP9808_ADDR_SKIP(a) false
+#endif /* _OW_DS2482_ */
+
+static bool i2ctemp_convert(uint8_t type, uint16_t raw, int16_t *decicelsius)
+{
+    int16_t ret;
+
+    if (type == I2CTEMP_MCP9808)
+    {
+        /* Top 3 bits are alert flags. Sign extend from bit 12, 1/16 degree */
+        ret = (int16_t)(raw << 3) >> 3;
+        ret = ((int32_t)ret * 10) / 16;
+    }
+    else
+    {
+        /* 1/256 degree */
+        ret = ((int32_t)(int16_t)raw * 10) / 256;
+    }
+
+    if (ret < I2CTEMP_MIN || ret > I2CTEMP_MAX)
+        return false;
+
+    *decicelsius = ret;
+    return true;
+}
+
+static bool i2ctemp_add(i2ctemp_t *sensor, uint8_t addr, uint8_t type)
+{
+    int16_t decicelsius;
+
+    sensor->addr = addr;
+    sensor->type = type;
+
+    /* Something that doesn't give a sane reading isn't a sensor */
+    return i2ctemp_read_decicelsius(sensor, &decicelsius);
+}
+
+/*
+ * Looks for sensors at every address they can be strapped to, up to
+ * max of them. MCP9808s are identified by their ID registers. The LM75
+ * class has none, so anything at their addresses that reads back a
+ * plausible temperature is taken to be one.
+ */
+uint8_t i2ctemp_probe(i2ctemp_t *sensors, uint8_t max)
+{
+    uint8_t count = 0;
+    uint16_t id;
+    uint8_t addr;
+
+    for (addr = MCP9808_ADDR_FIRST; addr <= MCP9808_ADDR_LAST && count < max; addr++)
+    {
+        if (MCP9808_ADDR_SKIP(addr))
+            continue;
+
+        if (!i2c_read16(addr, MCP9808_REG_MFR_ID, &id) || id != MCP9808_MFR_ID)
+            continue;
+
+        if (!i2c_read16(addr, MCP9808_REG_DEV_ID, &id) || (id >> 8) != MCP9808_DEV_ID)
+            continue;
+
+        if (i2ctemp_add(&sensors[count], addr, I2CTEMP_MCP9808))
+            count++;
+    }
+
+    for (addr = LM75_ADDR_FIRST; addr <= LM75_ADDR_LAST && count < max; addr++)
+    {
+        if (i2ctemp_add(&sensors[count], addr, I2CTEMP_LM75))
+            count++;
+    }
+
+    return count;
+}
+
+bool i2ctemp_read_decicelsius(const i2ctemp_t *sensor, int16_t *decicelsius)
+{
+    uint16_t raw;
+
+    if (!i2c_read16(sensor->addr, sensor->type == I2CTEMP_MCP9808 ? MCP9808_REG_TEMP : LM75_REG_TEMP, &raw))
+        return false;
+
+    return i2ctemp_convert(sensor->type, raw, decicelsius);
+}
+
+const char *i2ctemp_name(const i2ctemp_t *sensor)
+{
+    return sensor->type == I2CTEMP_MCP9808 ? "MCP9808" : "LM75";
+}
+
+#endif /* _I2C_TEMP_ */
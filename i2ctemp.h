@@ -0,0 +1,44 @@
+/*
+ *   File:   i2ctemp.h
+ *   Author: Matthew Millman
+ *
+ *   Fan speed controller. OSS AVR Version.
+ *
+ *   LM75, TMP102 and MCP9808 class I2C temperature sensors
+ *
+ *   Created on 17 October 2026, 18:20
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __I2CTEMP_H__
+#define __I2CTEMP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define I2CTEMP_LM75         0       /* Also TMP102, TMP75, DS75 and the like */
+#define I2CTEMP_MCP9808      1
+
+/* How often the control loop runs when there are no 1-Wire sensors to wait for */
+#define I2CTEMP_PERIOD_MS    100
+
+typedef struct {
+    uint8_t addr;
+    uint8_t type;
+} i2ctemp_t;
+
+uint8_t i2ctemp_probe(i2ctemp_t *sensors, uint8_t max);
+bool i2ctemp_read_decicelsius(const i2ctemp_t *sensor, int16_t *decicelsius);
+const char *i2ctemp_name(const i2ctemp_t *sensor);
+
+#endif /* __I2CTEMP_H__ */
@@ -87,12 +87,22 @@
 #define SP5_DDR            DDRD
 #define SP6_DDR            DDRD
 
-#define SDA_DDR            PORTC
+/* Parallel 1-Wire buses. All on one port so a time slot can drive and sample them together */
+#define OWPAR_PORT         PORTD
+#define OWPAR_PIN          PIND
+#define OWPAR_DDR          DDRD
+#define OWPAR_BUS0         SP2
+#define OWPAR_BUS1         SP3
+#define OWPAR_BUS2         SP5
+#define OWPAR_BUS3         SP6
+#define OWPAR_BUSES        4
+
+#define SDA_DDR            DDRC
 #define SDA_PIN            PINC
 #define SDA_PORT           PORTC
 #define SDA                PC4
 
-#define SCL_DDR            PORTC
+#define SCL_DDR            DDRC
 #define SCL_PIN            PINC
 #define SCL_PORT           PORTC
 #define SCL                PC5
@@ -124,6 +134,7 @@
 #define TXENA              TXEN0
 #define UMSELA0            UMSEL00
 #define UDREA              UDRE0
+#define U2XA               U2X0
 #define UDRA               UDR0
 #define DORA               DOR0
 #define FEA                FE0
@@ -42,15 +42,111 @@
 #include "i2c.h"
 #include "ds2482.h"
 #include "ds18x20.h"
+#include "sched.h"
+#include "tach.h"
+#include "ow_async.h"
+#include "ow_parallel.h"
+#include "i2ctemp.h"
+#include "telemetry.h"
+#include "modbus.h"
+
+#define TASK_CONSOLE         0
+#define TASK_CONVERT         1
+#define TASK_READOUT         2
+#define TASK_CONTROL         3
+#define TASK_REPORT          4
+#define TASK_STALL           5
+#define TASK_TACH            6
+#define TASK_RPMCTL          7
+
+#define REPORT_TICKS         100     /* Status output once per second */
+#define STALL_CHECK_TICKS    100
+#define STALL_CHECK_DELAY    500     /* Don't do the stall check straight away */
+
+/* Stall recovery, per fan. Times are in stall checks (seconds) */
+#define STALL_OK             0
+#define STALL_KICK           1       /* Held at max to restart it */
+#define STALL_VERIFY         2       /* Back under control, making sure it stays running */
+#define STALL_BACKOFF        3       /* Didn't restart. Waiting to try again */
+#define STALL_FAULT          4       /* Given up. Held at max until reset */
+
+#define STALL_KICK_TIME      3
+#define STALL_VERIFY_TIME    5
+#define STALL_BACKOFF_TIME   10      /* Doubles with each failed attempt */
+#define STALL_MAX_TRIES      5
+
+/*
+ * Duty is in PWM counts (0 to PWM_BASE) everywhere in the control path.
+ * Percentages from the config are converted once at startup.
+ */
+
+/* Closed loop fan speed. Duty is held in 1/64 PWM count internally */
+#define RPM_CTL_TICKS        10
+#define RPM_FRAC_BITS        6
+#define RPM_KP               4       /* 1/64 count per RPM of error */
+#define RPM_KI               1       /* 1/64 count per RPM of error, per update */
+#define RPM_ERR_MAX          4000
+#define RPM_INTEG_MAX        ((PWM_BASE / 2) << RPM_FRAC_BITS)
+#define RPM_DUTY_MIN         5       /* ~1%. Don't let the loop switch a running fan off */
+
+/*
+ * Thermal PID. Gains are 1DP fixed point (see config). Output is
+ * held in 1/10000 %, which makes Ki * error * ticks land in those
+ * units without scaling
+ */
+#define PID_ERR_MAX          1000    /* 100 degrees */
+#define PID_DT_MAX           200     /* Ticks. Limits the step after a stall */
+#define PID_DERIV_MAX        10000   /* 100% in 1/100 % */
+
+/* 1/10000 % <-> PWM counts. 537 / 2^20 ~= PWM_BASE / 1000000 */
+#define pid_to_counts(x)     ((uint16_t)((((uint32_t)(x) >> 6) * 537 + 8192) >> 14))
+#define counts_to_pid(x)     (((int32_t)(x) * 15625) >> 3)
+
+typedef struct {
+    int32_t integ;
+    int16_t last;
+    bool primed;
+} pid_state_t;
+
+typedef struct {
+    uint8_t state;
+    uint8_t timer;
+    uint8_t tries;
+} stall_t;
+
+/* Linear ramp. Worked out once at startup */
+typedef struct {
+    uint16_t cnt_max;
+    uint16_t cnt_min;
+    uint16_t slope;      /* PWM counts per 0.1 degree, Q8.8 */
+} ramp_t;
+
+/* Fan curve. Slopes are PWM counts per 0.1 degree in Q8.8 */
+#define CURVE_SLOPE_SHIFT    8
+
+typedef struct {
+    uint8_t points;
+    int16_t *temp;
+    uint16_t cnt[CURVE_MAX_POINTS];
+    int32_t slope[CURVE_MAX_POINTS - 1];
+} curve_t;
 
 char _g_dotBuf[MAX_DESC];
 
 typedef struct {
     uint8_t sensor_ids[MAX_SENSORS][OW_ROMCODE_SIZE];
     uint8_t num_sensors;
-    uint8_t tach_timeout;
-    uint8_t last_portc;
-    uint16_t tach_count[MAX_FANS];
+    uint8_t num_ow;                 /* 1-Wire sensors come first, then I2C */
+#ifdef _I2C_TEMP_
+    i2ctemp_t i2c_sensors[MAX_SENSORS];
+    uint8_t num_i2c;
+#endif /* _I2C_TEMP_ */
+#ifdef _OW_PARALLEL_
+    uint8_t bus_mask;               /* Which bus each sensor is on, in sensor order */
+#endif /* _OW_PARALLEL_ */
+#ifdef _OW_DS2482_800_
+    uint8_t sensor_chan[MAX_SENSORS];   /* Sensors are grouped by channel */
+#endif /* _OW_DS2482_800_ */
     uint16_t tach_rpm[MAX_FANS];
 #ifdef _SINGLEZONE_
     bool hyst_lockout;
@@ -59,57 +155,85 @@ typedef struct {
 #endif
     uint8_t sensor_state;
     int16_t temp_result[MAX_SENSORS];
+#ifdef _SINGLEZONE_
+    int16_t temp_max_result;
+#endif
+    uint16_t fan_duty[MAX_FANS];
+    uint16_t fan_demand[MAX_FANS];
+    uint16_t rpm_target[MAX_FANS];
+    int16_t rpm_integ[MAX_FANS];
+    stall_t stall[MAX_FANS];
+    ramp_t ramp[MAX_FANS];
+    pid_state_t pid[MAX_FANS];
+    curve_t curve[MAX_FANS];
+    uint16_t ctl_last;
+    uint16_t ctl_dt;
+    uint16_t ctl_dt_inv;
+    bool conv_poll;
+    bool conv_broadcast;
+    uint16_t conv_start;
+    uint16_t conv_ticks;
+    uint16_t conv_timeout;
+    bool modbus;                    /* Latched at startup. The config can change under us */
+    bool read_active;
+    bool read_started;
+    uint8_t read_idx;
+    uint8_t read_state;
+#ifdef _SINGLEZONE_
+    int16_t read_max;
+#endif
 } sys_runstate_t;
 
 sys_config_t _g_cfg;
 sys_runstate_t _g_rs;
+#ifndef _OW_PARALLEL_
+static uint8_t _g_sensor_families[] = DS18B20_FAMILIES;
+#endif /* _OW_PARALLEL_ */
 
 static void io_init(void);
 static char *dots_for(const char *str);
-static void fan_set_duty(uint8_t pwm, uint8_t pct);
-static void print_duty(uint8_t duty);
-static void print_fan(uint8_t fan, uint16_t tach_rpm, uint8_t nl);
+static void fan_set_duty(uint8_t pwm, uint16_t duty);
+static void fan_demand(uint8_t fan, uint16_t duty, uint16_t maxrpm);
+static bool fan_forced(sys_runstate_t *rs, uint8_t fan);
+static void stall_check(sys_runstate_t *rs, uint8_t fan, uint16_t minrpm, uint16_t duty_max);
+static void print_duty(uint16_t duty);
+static void print_fan(uint8_t fan, uint16_t tach_rpm, uint16_t target_rpm, uint8_t nl);
 static void print_temp(uint8_t temp, int16_t result, const char *desc, uint8_t nl);
-static uint8_t calc_pwm_duty(int16_t measured, uint8_t pct_max, uint8_t pct_min, int16_t temp_max, int16_t temp_min, uint16_t hyst, uint8_t min_off, bool *hyst_lockout);
-static void main_process(sys_runstate_t *rs, sys_config_t *config);
-static void stall_check(sys_runstate_t *rs, sys_config_t *config);
+static void update_ctl_dt(sys_runstate_t *rs);
+static void send_telemetry(sys_runstate_t *rs);
+static uint16_t calc_duty(uint8_t zone, int16_t measured, int16_t temp_max, int16_t temp_min, uint16_t hyst, uint8_t min_off, int16_t setpoint, bool *hyst_lockout);
+static void ramp_init(ramp_t *ramp, uint8_t pct_max, uint8_t pct_min, int16_t temp_max, int16_t temp_min);
+static uint16_t calc_pwm_duty(ramp_t *ramp, int16_t measured, int16_t temp_max, int16_t temp_min);
+static uint16_t calc_pid_duty(pid_state_t *pid, ramp_t *ramp, int16_t measured, int16_t setpoint);
+static void curve_init(curve_t *curve, uint8_t points, int16_t *temp, uint8_t *duty);
+static void apply_configuration(sys_runstate_t *rs, sys_config_t *config);
+static uint16_t calc_curve_duty(curve_t *curve, ramp_t *ramp, int16_t measured);
+static void task_console(void);
+static void task_convert(void);
+static void task_readout(void);
+static void readout_store(sys_runstate_t *rs, uint8_t idx, bool ok, int16_t reading);
+#ifndef _OW_PARALLEL_
+static bool sensor_channel(sys_runstate_t *rs, uint8_t idx);
+static bool sensor_first_on_channel(sys_runstate_t *rs, uint8_t idx);
+#endif /* _OW_PARALLEL_ */
+static void task_control(void);
+static void task_report(void);
+static void task_stall(void);
+static void task_tach(void);
+static void task_rpmctl(void);
 uint8_t build_sensorlist_from_config(sys_runstate_t *rs, sys_config_t *config);
 
 FILE uart_str = FDEV_SETUP_STREAM(print_char, NULL, _FDEV_SETUP_RW);
 
-ISR(PCINT1_vect)
-{
-    if (!(_g_rs.last_portc & _BV(F1TACH)) && IO_IN_HIGH(F1TACH))
-        _g_rs.tach_count[0]++;
-
-    if (!(_g_rs.last_portc & _BV(F2TACH)) && IO_IN_HIGH(F2TACH))
-        _g_rs.tach_count[1]++;
-
-    _g_rs.last_portc = F1TACH_PIN;
-}
-
 ISR(TIMER0_OVF_vect)
 {
-    _g_rs.tach_timeout++;
-
-    if (_g_rs.tach_timeout == 200)
-    {
-        uint8_t i = 0;
-        for (i = 0; i < MAX_FANS; i++)
-        {
-            /* Sampled every 2 seconds. Multiply count by 30 to get RPM */
-            _g_rs.tach_rpm[i] = _g_rs.tach_count[i] * 30;
-            _g_rs.tach_count[i] = 0;
-        }
-        _g_rs.tach_timeout = 0;
-    }
-
+    sched_tick();
     timer0_reload(TIMER0VAL);
+    pwm_ramp_tick();
 }
 
 int main(void)
 {
-    uint8_t stall_check_cycleskip = 0;
     uint8_t i;
     sys_runstate_t *rs = &_g_rs;
     sys_config_t *config = &_g_cfg;
@@ -119,13 +243,14 @@ int main(void)
     g_irq_enable();
     io_init();
     timer0_init();
+    timer2_init();
 
-    usart1_open(USART_CONT_RX | USART_BRGH, (((F_CPU / UART_BAUD) / 16) - 1));
+    usart1_open(USART_CONT_RX, (((F_CPU / UART_BAUD) / 16) - 1));
     stdout = &uart_str;
 
-#ifdef _OW_DS2482_
+#ifdef _I2C_
     i2c_init(I2C_FREQ);
-#endif /* _OW_DS2482_ */
+#endif /* _I2C_ */
     ow_init();
     
     load_configuration(config);
@@ -136,18 +261,35 @@ int main(void)
 
     configuration_bootprompt(config);
 
+    /* The prompt always runs at UART_BAUD so a bad setting can't lock us out */
+    if (config->console_baud != UART_BAUD)
+    {
+        printf("Switching console to %lu baud\r\n", config->console_baud);
+
+        if (!usart1_set_baud(config->console_baud))
+            printf("Warning: %lu baud not possible\r\n", config->console_baud);
+    }
+
+    apply_configuration(rs, config);
+
     /* Clear tachos */
-    rs->tach_timeout = 0;
-    rs->last_portc = PORTB;
+    tach_init();
     rs->sensor_state = 0;
+    rs->read_active = false;
 
     for (i = 0; i < MAX_SENSORS; i++)
         rs->temp_result[i] = 0;
 
     for (i = 0; i < MAX_FANS; i++)
     {
-        rs->tach_count[i] = 0;
         rs->tach_rpm[i] = 0;
+        rs->fan_duty[i] = 0;
+        rs->fan_demand[i] = 0;
+        rs->rpm_target[i] = 0;
+        rs->rpm_integ[i] = 0;
+        rs->pid[i].primed = false;
+        rs->stall[i].state = STALL_OK;
+        rs->stall[i].tries = 0;
     }
 
     /* Hysteresis lockout on so we don't start fans if temp is inside hysteresis window */
@@ -157,43 +299,176 @@ int main(void)
     for (i = 0; i < MAX_FANS; i++)
         rs->hyst_lockout[i] = true;
 #endif /* _SINGLEZONE_ */
-    
+
+#ifdef _OW_PARALLEL_
+    /* One sensor per bus, identified by bus. Manual assignment doesn't apply */
+    owpar_init();
+    rs->num_sensors = owpar_probe(rs->sensor_ids, MAX_SENSORS, &rs->bus_mask);
+    printf("\r\nFound %u of %u maximum sensors\r\n", rs->num_sensors, MAX_SENSORS);
+#else
     if (config->manual_assignment)
     {
         rs->num_sensors = build_sensorlist_from_config(rs, config);
         printf("\r\nManually assigned %u of %u maximum sensors\r\n", rs->num_sensors, MAX_SENSORS);
+#ifdef _OW_DS2482_800_
+        for (i = 0; i < rs->num_sensors; i++)
+        {
+            if (!onewire_find_channel(rs->sensor_ids[i], &rs->sensor_chan[i]))
+            {
+                printf("Sensor %u not found on any channel\r\n", i + 1);
+                rs->sensor_chan[i] = 0;
+            }
+        }
+#endif /* _OW_DS2482_800_ */
     }
     else
     {
-        uint8_t ow_device_type = DS18B20_FAMILY_CODE;
-        if (onewire_search_devices(rs->sensor_ids, &ow_device_type, &rs->num_sensors, sizeof(ow_device_type)))
+        uint8_t counts[sizeof(_g_sensor_families)];
+        uint8_t f;
+#ifdef _OW_DS2482_800_
+        if (onewire_search_channels(rs->sensor_ids, rs->sensor_chan, _g_sensor_families, counts, sizeof(_g_sensor_families)))
+#else
+        if (onewire_search_devices(rs->sensor_ids, _g_sensor_families, counts, sizeof(_g_sensor_families)))
+#endif /* _OW_DS2482_800_ */
+        {
+            rs->num_sensors = 0;
+            for (f = 0; f < sizeof(_g_sensor_families); f++)
+                rs->num_sensors += counts[f];
             printf("\r\nFound %u of %u maximum sensors\r\n", rs->num_sensors, MAX_SENSORS);
+        }
         else
+        {
             printf("\r\nHardware error searching for sensors\r\n");
+        }
     }
+#endif /* _OW_PARALLEL_ */
+
+    rs->num_ow = rs->num_sensors;
+
+#ifdef _I2C_TEMP_
+    rs->num_i2c = i2ctemp_probe(rs->i2c_sensors, MAX_SENSORS - rs->num_ow);
+    rs->num_sensors += rs->num_i2c;
+
+    for (i = 0; i < rs->num_i2c; i++)
+        printf("Found %s at I2C address 0x%02X (sensor %u)\r\n", i2ctemp_name(&rs->i2c_sensors[i]), rs->i2c_sensors[i].addr, rs->num_ow + i + 1);
+#endif /* _I2C_TEMP_ */
 
     if (rs->num_sensors == 0)
         printf("No sensors found. Fans will be set to max\r\n");
 
+    rs->conv_poll = false;
+    rs->conv_broadcast = false;
+    /* Plus one, as the wait starts part way through a tick */
+    rs->conv_timeout = sched_ms_to_ticks(DS18B20_TCONV(config->sensor_res)) + 1;
+
+#ifdef _I2C_TEMP_
+    /* Nothing to wait for. Run the loop as fast as the sensors update */
+    if (rs->num_ow == 0 && rs->num_i2c > 0)
+        rs->conv_timeout = sched_ms_to_ticks(I2CTEMP_PERIOD_MS);
+#endif /* _I2C_TEMP_ */
+
+#ifdef _OW_PARALLEL_
+    if (rs->num_ow > 0)
+    {
+        bool parasite;
+
+        if (!ds18b20_par_set_resolution(rs->bus_mask, config->sensor_res))
+            printf("Failed to set resolution of one or more sensors\r\n");
+
+        if (ds18b20_par_parasite_powered(rs->bus_mask, &parasite) && !parasite)
+            rs->conv_poll = true;
+        else
+            printf("Parasite powered sensors present. Using fixed conversion time\r\n");
+    }
+#else
+    for (i = 0; i < rs->num_ow; i++)
+    {
+        if (!sensor_channel(rs, i) || !ds18b20_set_resolution(rs->sensor_ids[i], config->sensor_res))
+            printf("Failed to set resolution of sensor %u\r\n", i + 1);
+    }
+
+    if (rs->num_ow > 0)
+    {
+        bool parasite;
+        bool single;
+
+        rs->conv_broadcast = true;
+        rs->conv_poll = true;
+
+        /* Each channel is a separate bus segment. All of them have to qualify */
+        for (i = 0; i < rs->num_ow; i++)
+        {
+            if (!sensor_first_on_channel(rs, i))
+                continue;
+
+            if (!sensor_channel(rs, i))
+            {
+                rs->conv_broadcast = false;
+                rs->conv_poll = false;
+                continue;
+            }
+
+            /* Convert T can only be broadcast if nothing else on the bus will see it */
+            if (!onewire_single_family(_g_sensor_families, sizeof(_g_sensor_families), &single) || !single)
+                rs->conv_broadcast = false;
+
+            /* Externally powered sensors can tell us when they have finished converting */
+            if (!ds18b20_parasite_powered(&parasite) || parasite)
+                rs->conv_poll = false;
+        }
+
+        /*
+         * Started one at a time, a read slot only shows the last sensor
+         * addressed. Conversion time varies part to part, so an earlier
+         * one could still be converting when that one has finished.
+         */
+        if (!rs->conv_broadcast)
+        {
+            rs->conv_poll = false;
+            printf("Other 1-Wire devices present. Addressing sensors individually, fixed conversion time\r\n");
+        }
+        else if (!rs->conv_poll)
+        {
+            printf("Parasite powered sensors present. Using fixed conversion time\r\n");
+        }
+    }
+#endif /* _OW_PARALLEL_ */
+
 #ifdef _SINGLEZONE_
     printf("Using %u of %u maximum fans\r\n", config->num_fans, MAX_FANS);
 #endif /* _SINGLEZONE_ */
 
+    sched_init();
+    sched_add(TASK_CONSOLE, task_console, 1, 0);
+    sched_add(TASK_CONVERT, task_convert, 0, 0);
+    sched_add(TASK_READOUT, task_readout, 0, SCHED_SUSPENDED);
+    sched_add(TASK_CONTROL, task_control, 0, SCHED_SUSPENDED);
+    sched_add(TASK_REPORT, task_report, REPORT_TICKS, REPORT_TICKS);
+    sched_add(TASK_STALL, task_stall, STALL_CHECK_TICKS, STALL_CHECK_DELAY);
+    sched_add(TASK_TACH, task_tach, 1, 0);
+    sched_add(TASK_RPMCTL, task_rpmctl, RPM_CTL_TICKS, RPM_CTL_TICKS);
+
     timer0_start();
 	wdt_reset();
 
-    printf("Press Ctrl+D at any time to reset\r\n");
+    rs->modbus = config->modbus_addr != 0;
+
+    if (rs->modbus)
+    {
+        /* Text would collide with the master on the bus */
+        printf("Modbus RTU slave at address %u. Console output off\r\n", config->modbus_addr);
+        while (console_busy());
+        print_mute(true);
+        modbus_init(config->modbus_addr, config->console_baud);
+    }
+    else
+    {
+        printf("Press Ctrl+D at any time to reset, Ctrl+T for task timings, Ctrl+C for the configuration prompt\r\n");
+    }
     
     for (;;)
     {
-        main_process(rs, config);
-
-        /* Don't do the stall check straight away */
-        if (stall_check_cycleskip < 5)
-            stall_check_cycleskip++;
-        else
-            stall_check(rs, config);
-
+        sched_run();
         wdt_reset();
     }
 }
@@ -210,156 +485,389 @@ static void io_init(void)
     IO_INPUT(SP4);
     IO_INPUT(SP5);
     IO_INPUT(SP6);
+}
 
-    PCICR |= _BV(PCIE1);
-    PCMSK1 |= _BV(PCINT10);
-    PCMSK1 |= _BV(PCINT11);
+static void task_console(void)
+{
+    if (_g_rs.modbus)
+    {
+        modbus_poll();
+        return;
+    }
 
-    _g_rs.last_portc = F1TACH_PIN;
+    /*
+     * All of it, so a pasted line doesn't overrun the RX buffer. Input
+     * waits while the prompt is still printing a listing.
+     */
+    while (configuration_shell_print(&_g_cfg) && console_data_ready())
+    {
+        char c = console_get();
+        if (c == 4)
+        {
+            printf("\r\nCtrl+D received. Resetting...\r\n");
+            while (console_busy());
+            reset();
+        }
+        if (configuration_shell_active())
+        {
+            if (configuration_shell(&_g_cfg, c))
+                apply_configuration(&_g_rs, &_g_cfg);
+            continue;
+        }
+        if (c == 3) /* Ctrl + C */
+            configuration_shell_open();
+        if (c == 20) /* Ctrl + T */
+        {
+            sched_print_stats();
+            printf("Last conversion time ..........: %u ms\r\n", _g_rs.conv_ticks * SCHED_TICK_MS);
+            printf("Console bytes dropped .........: %u\r\n", console_tx_dropped());
+            printf("Telemetry frames dropped ......: %u\r\n", telemetry_dropped());
+#ifdef _I2C_
+            i2c_print_stats();
+#endif /* _I2C_ */
+        }
+    }
 }
 
-#ifdef _SINGLEZONE_
+static void task_tach(void)
+{
+    tach_update(_g_rs.tach_rpm);
+}
 
-static void main_process(sys_runstate_t *rs, sys_config_t *config)
+static void task_convert(void)
 {
+    sys_runstate_t *rs = &_g_rs;
+#ifdef _OW_PARALLEL_
+    ds18b20_par_start_meas(rs->bus_mask);
+#else
     uint8_t i;
-    int16_t result = 0;
-    uint8_t state_temp = 0;
 
-    for (i = 0; i < rs->num_sensors; i++)
-        ds18b20_start_meas(rs->sensor_ids[i]);
+    /* With a DS2482-800, every channel converts at once */
+    for (i = 0; i < rs->num_ow; i++)
+    {
+        if (sensor_first_on_channel(rs, i))
+        {
+            sensor_channel(rs, i);
+
+            if (rs->conv_broadcast)
+                ds18b20_start_meas_all();
+        }
 
-    delay_10ms(76);
+        if (!rs->conv_broadcast)
+            ds18b20_start_meas(rs->sensor_ids[i]);
+    }
+#endif /* _OW_PARALLEL_ */
+
+    rs->conv_start = sched_now();
+
+    /* The bus is idle while the sensors convert. Come back when they're done */
+    if (rs->conv_poll)
+        sched_wake(TASK_READOUT, 1);
+    else
+        sched_wake(TASK_READOUT, rs->conv_timeout);
+}
+
+static void task_readout(void)
+{
+    sys_runstate_t *rs = &_g_rs;
+#if !defined(_OW_PARALLEL_) || defined(_I2C_TEMP_)
+    int16_t reading;
+#endif /* !_OW_PARALLEL_ || _I2C_TEMP_ */
+#if !defined(_OW_ASYNC_) || defined(_I2C_TEMP_)
+    uint8_t i;
+#endif /* !_OW_ASYNC_ || _I2C_TEMP_ */
 
-    for (i = 0; i < rs->num_sensors; i++)
+    if (!rs->read_active)
     {
-        int16_t reading_temp;
+        rs->conv_ticks = sched_now() - rs->conv_start;
 
-        if (ds18b20_read_decicelsius(rs->sensor_ids[i], &reading_temp))
+#ifndef _OW_DS2482_800_
+        /* Poll until done, giving up on polling at the worst case conversion time */
+        if (rs->conv_poll && rs->conv_ticks < rs->conv_timeout)
         {
-            result = max_(result, reading_temp);
-            rs->temp_result[i] = reading_temp;
-            state_temp |= (1 << i);
+            bool complete;
+
+#ifdef _OW_PARALLEL_
+            if (ds18b20_par_conv_complete(rs->bus_mask, &complete) && !complete)
+#else
+            if (ds18b20_conv_complete(&complete) && !complete)
+#endif /* _OW_PARALLEL_ */
+            {
+                sched_wake(TASK_READOUT, 1);
+                return;
+            }
         }
+#endif /* _OW_DS2482_800_ */
+
+        rs->read_active = true;
+        rs->read_started = false;
+        rs->read_idx = 0;
+        rs->read_state = 0;
+#ifdef _SINGLEZONE_
+        rs->read_max = 0;
+#endif /* _SINGLEZONE_ */
     }
-    
-    rs->sensor_state = state_temp;
-        
-    if (console_data_ready())
+
+#ifdef _OW_ASYNC_
+    /* One sensor per pass. The bus is clocked from the Timer2 compare ISR in between */
+    if (owasync_busy())
     {
-        char c = console_get();
-        if (c == 4)
+        sched_wake(TASK_READOUT, 1);
+        return;
+    }
+
+    if (rs->read_started)
+    {
+        readout_store(rs, rs->read_idx, ds18b20_read_finish(&reading), reading);
+        rs->read_started = false;
+        rs->read_idx++;
+    }
+
+    if (rs->read_idx < rs->num_ow)
+    {
+#ifdef _OW_OVERDRIVE_
+        /* An overdrive read is over in ~3ms. Quicker to just do it */
+        if (onewire_overdrive_capable(rs->sensor_ids[rs->read_idx][0]))
         {
-            printf("\r\nCtrl+D received. Resetting...\r\n");
-            while (console_busy());
-            reset();
+            readout_store(rs, rs->read_idx, ds18b20_read_decicelsius(rs->sensor_ids[rs->read_idx], &reading), reading);
+            rs->read_idx++;
+            sched_wake(TASK_READOUT, 1);
+            return;
         }
+#endif /* _OW_OVERDRIVE_ */
+
+        rs->read_started = ds18b20_read_start(rs->sensor_ids[rs->read_idx]);
+
+        if (!rs->read_started)
+            rs->read_idx++;
+
+        sched_wake(TASK_READOUT, 1);
+        return;
     }
-    
-    if (rs->num_sensors == 0)
+#elif defined(_OW_PARALLEL_)
     {
-        if (config->num_fans > 0)
-        {
-            for (i = 0; i < config->num_fans; i++)
-                print_fan(i, rs->tach_rpm[i], i == 0);
+        int16_t bus_reading[OWPAR_BUSES];
+        uint8_t ok;
+        uint8_t bus;
 
-            print_duty(config->fans_max);
-            fan_set_duty(FAN1, config->fans_max);
-            fan_set_duty(FAN2, config->fans_max);
-        }
-        else
+        /* Every sensor in the time it takes to read one */
+        ds18b20_par_read_decicelsius(rs->bus_mask, bus_reading, &ok);
+
+        for (bus = 0, i = 0; bus < OWPAR_BUSES; bus++)
         {
-            printf("Nothing to do\r\n");
+            if (rs->bus_mask & (1 << bus))
+                readout_store(rs, i++, ok & (1 << bus), bus_reading[bus]);
         }
     }
-
-    if (rs->num_sensors > 0)
+#elif defined(_OW_DS2482_800_)
+    /*
+     * Channel by channel. Each is polled on its own and read as soon as
+     * it's done, while the channels after it carry on converting.
+     */
+    for (; rs->read_idx < rs->num_ow; rs->read_idx++)
     {
-        // Bail out if any temperature sensors are offline
-        if (((1 << rs->num_sensors) - 1) == rs->sensor_state && rs->num_sensors >= config->min_temps)
+        i = rs->read_idx;
+
+        if (sensor_first_on_channel(rs, i))
         {
-            uint8_t duty = calc_pwm_duty(result, config->fans_max, config->fans_min, config->temp_max,
-                    config->temp_min, config->temp_hyst, config->fans_minoff, &rs->hyst_lockout);
+            bool complete;
+
+            sensor_channel(rs, i);
 
-            for (i = 0; i < rs->num_sensors; i++)
+            if (rs->conv_poll && (uint16_t)(sched_now() - rs->conv_start) < rs->conv_timeout &&
+                    ds18b20_conv_complete(&complete) && !complete)
             {
-                const char *desc = NULL;
-                
-                switch (i)
-                {
-                case 0:
-                    desc = config->temp1_desc;
-                    break;
-                case 1:
-                    desc = config->temp2_desc;
-                    break;
-                case 2:
-                    desc = config->temp3_desc;
-                    break;
-                case 3:
-                    desc = config->temp4_desc;
-                    break;
-                }
-
-                print_temp(i, rs->temp_result[i], desc, i == 0);
+                sched_wake(TASK_READOUT, 1);
+                return;
             }
+        }
+
+        readout_store(rs, i, ds18b20_read_decicelsius(rs->sensor_ids[i], &reading), reading);
+    }
 
-            print_temp(rs->num_sensors, result, "max", 0);
+    rs->conv_ticks = sched_now() - rs->conv_start;
+#else
+    for (i = 0; i < rs->num_ow; i++)
+        readout_store(rs, i, ds18b20_read_decicelsius(rs->sensor_ids[i], &reading), reading);
+#endif /* _OW_ASYNC_ */
+
+#ifdef _I2C_TEMP_
+    /* Always converting, so only the register read is left */
+    for (i = 0; i < rs->num_i2c; i++)
+        readout_store(rs, rs->num_ow + i, i2ctemp_read_decicelsius(&rs->i2c_sensors[i], &reading), reading);
+#endif /* _I2C_TEMP_ */
+
+    rs->read_active = false;
+    rs->sensor_state = rs->read_state;
+#ifdef _SINGLEZONE_
+    rs->temp_max_result = rs->read_max;
+#endif /* _SINGLEZONE_ */
 
-            if (config->num_fans > 0)
-            {
-                for (i = 0; i < config->num_fans; i++)
-                    print_fan(i, rs->tach_rpm[i], i == 0);
+    sched_wake(TASK_CONTROL, 0);
+}
 
-                print_duty(duty);
-                
-                fan_set_duty(FAN1, duty);
-                fan_set_duty(FAN2, duty);
-            }
-        }
+static void readout_store(sys_runstate_t *rs, uint8_t idx, bool ok, int16_t reading)
+{
+    if (!ok)
+        return;
+
+#ifdef _SINGLEZONE_
+    rs->read_max = max_(rs->read_max, reading);
+#endif /* _SINGLEZONE_ */
+    rs->temp_result[idx] = reading;
+    rs->read_state |= (1 << idx);
+}
+
+#ifndef _OW_PARALLEL_
+
+/* Points the DS2482-800 at the channel a sensor is on */
+static bool sensor_channel(sys_runstate_t *rs, uint8_t idx)
+{
+#ifdef _OW_DS2482_800_
+    return ds2482_select_channel(rs->sensor_chan[idx]);
+#else
+    return true;
+#endif /* _OW_DS2482_800_ */
+}
+
+static bool sensor_first_on_channel(sys_runstate_t *rs, uint8_t idx)
+{
+#ifdef _OW_DS2482_800_
+    return idx == 0 || rs->sensor_chan[idx] != rs->sensor_chan[idx - 1];
+#else
+    return idx == 0;
+#endif /* _OW_DS2482_800_ */
+}
+
+#endif /* _OW_PARALLEL_ */
+
+#ifdef _SINGLEZONE_
+
+static bool sensors_ok(sys_runstate_t *rs, sys_config_t *config)
+{
+    // Bail out if any temperature sensors are offline
+    return ((1 << rs->num_sensors) - 1) == rs->sensor_state && rs->num_sensors >= config->min_temps;
+}
+
+static void task_control(void)
+{
+    sys_runstate_t *rs = &_g_rs;
+    sys_config_t *config = &_g_cfg;
+    uint16_t duty = rs->ramp[0].cnt_max;
+
+    update_ctl_dt(rs);
+
+    if (rs->num_sensors > 0 && sensors_ok(rs, config))
+    {
+        duty = calc_duty(0, rs->temp_max_result, config->temp_max, config->temp_min, config->temp_hyst,
+                config->fans_minoff, config->temp_setpoint, &rs->hyst_lockout);
+    }
+
+    if (config->num_fans > 0)
+    {
+        fan_demand(FAN1, duty, config->fans_maxrpm);
+        fan_demand(FAN2, duty, config->num_fans > 1 ? config->fans_maxrpm : 0);
+    }
+
+    /* Every control cycle, rather than once a second like the text report */
+    if (config->telemetry && !rs->modbus && !configuration_shell_active())
+        send_telemetry(rs);
+
+    /* Start the next conversion straight away */
+    sched_wake(TASK_CONVERT, 0);
+}
+
+static void print_fans(sys_runstate_t *rs, sys_config_t *config)
+{
+    uint8_t i;
+
+    for (i = 0; i < config->num_fans; i++)
+    {
+        print_fan(i, rs->tach_rpm[i], rs->rpm_target[i], i == 0);
+
+        /* Each fan finds its own duty when holding a speed */
+        if (config->fans_maxrpm)
+            print_duty(rs->fan_duty[i]);
+    }
+
+    if (!config->fans_maxrpm)
+        print_duty(rs->fan_duty[FAN1]);
+}
+
+static void task_report(void)
+{
+    sys_runstate_t *rs = &_g_rs;
+    sys_config_t *config = &_g_cfg;
+    uint8_t i;
+
+    if (config->telemetry || rs->modbus || configuration_shell_active())
+        return;
+
+    if (rs->num_sensors == 0)
+    {
+        if (config->num_fans > 0)
+            print_fans(rs, config);
         else
         {
-            if (config->num_fans > 0)
-            {
-                printf("Insufficient number of operational sensors. Setting to max\r\n");
-
-                fan_set_duty(FAN1, config->fans_max);
-                fan_set_duty(FAN2, config->fans_max);
-            }
-            else
+            printf("Nothing to do\r\n");
+        }
+    }
+    else if (sensors_ok(rs, config))
+    {
+        for (i = 0; i < rs->num_sensors; i++)
+        {
+            const char *desc = NULL;
+            
+            switch (i)
             {
-                printf("No fans or insufficient sensors present\r\n");
+            case 0:
+                desc = config->temp1_desc;
+                break;
+            case 1:
+                desc = config->temp2_desc;
+                break;
+            case 2:
+                desc = config->temp3_desc;
+                break;
+            case 3:
+                desc = config->temp4_desc;
+                break;
             }
+
+            print_temp(i, rs->temp_result[i], desc, i == 0);
         }
+
+        print_temp(rs->num_sensors, rs->temp_max_result, "max", 0);
+
+        if (config->num_fans > 0)
+            print_fans(rs, config);
+    }
+    else
+    {
+        if (config->num_fans > 0)
+            printf("Insufficient number of operational sensors. Setting to max\r\n");
+        else
+            printf("No fans or insufficient sensors present\r\n");
     }
 }
 
-static void stall_check(sys_runstate_t *rs, sys_config_t *config)
+static void task_stall(void)
 {
-    uint16_t minrpm = 0xFFFF;
+    sys_runstate_t *rs = &_g_rs;
+    sys_config_t *config = &_g_cfg;
     uint8_t i;
-    
+
+    if (config->fans_minoff)
+        return;
+
     for (i = 0; i < config->num_fans; i++)
-        minrpm = min_(minrpm, rs->tach_rpm[i]);
-    
-   /* Check for fan 1 stall */
-    if (!config->fans_minoff && (minrpm < config->fans_minrpm))
-    {
-        printf("Fan stall. Restarting...\r\n");
-        fan_set_duty(FAN1, config->fans_max);
-        fan_set_duty(FAN2, config->fans_max);
-        wdt_reset();
-        delay_10ms(150);
-        wdt_reset();
-        delay_10ms(150);
-        wdt_reset();
-    }
+        stall_check(rs, i, config->fans_minrpm, rs->ramp[0].cnt_max);
 }
 
 void set_start_duty(sys_config_t *config)
 {
-    fan_set_duty(FAN1, config->fans_start);
-    fan_set_duty(FAN2, config->fans_start);
+    fan_set_duty(FAN1, pwm_pct_to_counts(config->fans_start));
+    fan_set_duty(FAN2, pwm_pct_to_counts(config->fans_start));
 }
 
 #else /* _SINGLEZONE_ */
@@ -370,138 +878,207 @@ void set_start_duty(sys_config_t *config)
 #define TEMP1                0
 #define TEMP2                1
 
-static void main_process(sys_runstate_t *rs, sys_config_t *config)
+static void task_control(void)
 {
-    uint8_t i;
+    sys_runstate_t *rs = &_g_rs;
+    sys_config_t *config = &_g_cfg;
+    uint16_t duty1 = rs->ramp[FAN1].cnt_max;
+    uint16_t duty2 = rs->ramp[FAN2].cnt_max;
+
+    update_ctl_dt(rs);
 
-    for (i = 0; i < rs->num_sensors; i++)
-        ds18b20_start_meas(rs->sensor_ids[i]);
+    if (rs->num_sensors > 0)
+    {
+        // At least one sensor, but only one fan case
 
-    delay_10ms(76);
+        if (rs->sensor_state & (1 << TEMP1))
+        {
+            duty1 = calc_duty(TEMP1, rs->temp_result[TEMP1], config->temp1_max, config->temp1_min,
+                    config->temp1_hyst, config->fan1_minoff, config->temp1_setpoint, &rs->hyst_lockout[TEMP1]);
 
-    if (console_data_ready())
+            if (rs->num_sensors == 1 && config->fan2_enabled)
+            {
+                // One sensor, but two fans. Calculate individual PWM duties from a single sensor using both sets of thresholds.
+
+                duty2 = calc_duty(TEMP2, rs->temp_result[TEMP1], config->temp2_max, config->temp2_min,
+                        config->temp2_hyst, config->fan2_minoff, config->temp2_setpoint, &rs->hyst_lockout[TEMP2]);
+            }
+        }
+    }
+
+    if (rs->num_sensors > 1 && config->fan2_enabled)
     {
-        char c = console_get();
-        if (c == 4)
+        // Two sensors, two fans. Deal with the second sensor
+
+        if (rs->sensor_state & (1 << TEMP2))
         {
-            printf("\r\nCtrl+D received. Resetting...\r\n");
-            while (console_busy());
-            reset();
+            duty2 = calc_duty(TEMP2, rs->temp_result[TEMP2], config->temp2_max, config->temp2_min,
+                    config->temp2_hyst, config->fan2_minoff, config->temp2_setpoint, &rs->hyst_lockout[TEMP2]);
         }
     }
-    
+
+    // Sensor failures and the no sensors case leave the fans at max
+
+    fan_demand(FAN1, duty1, config->fan1_maxrpm);
+
+    if (config->fan2_enabled)
+        fan_demand(FAN2, duty2, config->fan2_maxrpm);
+
+    /* Every control cycle, rather than once a second like the text report */
+    if (config->telemetry && !rs->modbus && !configuration_shell_active())
+        send_telemetry(rs);
+
+    /* Start the next conversion straight away */
+    sched_wake(TASK_CONVERT, 0);
+}
+
+static void task_report(void)
+{
+    sys_runstate_t *rs = &_g_rs;
+    sys_config_t *config = &_g_cfg;
+
+    if (config->telemetry || rs->modbus || configuration_shell_active())
+        return;
+
     if (rs->num_sensors == 0)
     {
         // No sensors case. Used fixed configuration.
 
-        fan_set_duty(FAN1, config->fan1_max);
-        print_fan(FAN1, rs->tach_rpm[0], 1);
-        print_duty(config->fan1_max);
+        print_fan(FAN1, rs->tach_rpm[FAN1], rs->rpm_target[FAN1], 1);
+        print_duty(rs->fan_duty[FAN1]);
             
         if (config->fan2_enabled)
         {
-            fan_set_duty(FAN2, config->fan2_max);
-            print_fan(FAN2, rs->tach_rpm[1], 0);
-            print_duty(config->fan2_max);
+            print_fan(FAN2, rs->tach_rpm[FAN2], rs->rpm_target[FAN2], 0);
+            print_duty(rs->fan_duty[FAN2]);
         }
     }
     if (rs->num_sensors > 0)
     {
-        // At least one sensor, but only one fan case
-
-        if (ds18b20_read_decicelsius(rs->sensor_ids[TEMP1], &rs->temp_result[0]))
+        if (rs->sensor_state & (1 << TEMP1))
         {
-            uint8_t duty1 = calc_pwm_duty(rs->temp_result[TEMP1], config->fan1_max, config->fan1_min, config->temp1_max,
-                    config->temp1_min, config->temp1_hyst, config->fan1_minoff, &rs->hyst_lockout[TEMP1]);
-
-            fan_set_duty(FAN1, duty1);
             print_temp(TEMP1, rs->temp_result[TEMP1], config->temp1_desc, 1);
-            print_fan(FAN1, rs->tach_rpm[FAN1], 0);
-            print_duty(duty1);
+            print_fan(FAN1, rs->tach_rpm[FAN1], rs->rpm_target[FAN1], 0);
+            print_duty(rs->fan_duty[FAN1]);
 
             if (rs->num_sensors == 1 && config->fan2_enabled)
             {
-                // One sensor, but two fans. Calculate individual PWM duties from a single sensor using both sets of thresholds.
-
-                uint8_t duty2 = calc_pwm_duty(rs->temp_result[TEMP1], config->fan2_max, config->fan2_min, config->temp2_max,
-                        config->temp2_min, config->temp2_hyst, config->fan2_minoff, &rs->hyst_lockout[TEMP2]);
-
-                fan_set_duty(FAN2, duty2);
-                print_fan(FAN2, rs->tach_rpm[FAN2], 0);
-                print_duty(duty2);
+                print_fan(FAN2, rs->tach_rpm[FAN2], rs->rpm_target[FAN2], 0);
+                print_duty(rs->fan_duty[FAN2]);
             }
         }
         else
         {
             printf("Failed to read sensor 1. Setting to max\r\n");
-            fan_set_duty(FAN1, config->fan1_max);
-
-            if (rs->num_sensors == 1 && config->fan2_enabled)
-                fan_set_duty(FAN2, config->fan2_max);
         }
     }
 
     if (rs->num_sensors > 1 && config->fan2_enabled)
     {
-        // Two sensors, two fans. Deal with the second sensor
-
-        if (ds18b20_read_decicelsius(rs->sensor_ids[TEMP2], &rs->temp_result[1]))
+        if (rs->sensor_state & (1 << TEMP2))
         {
-            uint8_t duty2 = calc_pwm_duty(rs->temp_result[TEMP2], config->fan2_max, config->fan2_min, config->temp2_max,
-                    config->temp2_min, config->temp2_hyst, config->fan2_minoff, &rs->hyst_lockout[TEMP2]);
-
-            fan_set_duty(FAN2, duty2);
             print_temp(TEMP2, rs->temp_result[TEMP2], config->temp2_desc, 0);
-            print_fan(FAN2, rs->tach_rpm[FAN2], 0);
-            print_duty(duty2);
+            print_fan(FAN2, rs->tach_rpm[FAN2], rs->rpm_target[FAN2], 0);
+            print_duty(rs->fan_duty[FAN2]);
         }
         else
         {
             printf("Failed to read sensor 2. Setting to max\r\n");
-            fan_set_duty(FAN2, config->fan2_max);
         }
     }
 }
 
-static void stall_check(sys_runstate_t *rs, sys_config_t *config)
+static void task_stall(void)
 {
-   /* Check for fan 1 stall */
-    if (!config->fan1_minoff && (rs->tach_rpm[FAN1] < config->fan1_minrpm))
-    {
-        printf("Fan 1 stall. Restarting...\r\n");
-        fan_set_duty(FAN1, config->fan1_max);
-        wdt_reset();
-        delay_10ms(150);
-        wdt_reset();
-        delay_10ms(150);
-        wdt_reset();
-    }
+    sys_runstate_t *rs = &_g_rs;
+    sys_config_t *config = &_g_cfg;
 
-    /* Check for fan 2 stall */
-    if (!config->fan2_minoff && config->fan2_enabled && (rs->tach_rpm[FAN2] < config->fan2_minrpm))
-    {
-        printf("Fan 2 stall. Restarting...\r\n");
-        fan_set_duty(FAN2, config->fan2_max);
-        wdt_reset();
-        delay_10ms(150);
-        wdt_reset();
-        delay_10ms(150);
-        wdt_reset();
-    }
+    if (!config->fan1_minoff)
+        stall_check(rs, FAN1, config->fan1_minrpm, rs->ramp[FAN1].cnt_max);
+
+    if (!config->fan2_minoff && config->fan2_enabled)
+        stall_check(rs, FAN2, config->fan2_minrpm, rs->ramp[FAN2].cnt_max);
 }
 
 void set_start_duty(sys_config_t *config)
 {
-    fan_set_duty(FAN1, config->fan1_start);
+    fan_set_duty(FAN1, pwm_pct_to_counts(config->fan1_start));
 
     if (config->fan2_enabled)
-        fan_set_duty(FAN2, config->fan2_start);
+        fan_set_duty(FAN2, pwm_pct_to_counts(config->fan2_start));
     else
         fan_set_duty(FAN2, 0);
 }
 
 #endif /* !_SINGLEZONE_ */
 
+static void send_telemetry(sys_runstate_t *rs)
+{
+    static uint8_t seq;
+    telemetry_status_t status;
+    uint8_t i;
+
+    status.type = TELEMETRY_STATUS;
+    status.seq = seq++;
+    status.slots = (MAX_SENSORS << 4) | MAX_FANS;
+    status.num_sensors = rs->num_sensors;
+    status.sensor_state = rs->sensor_state;
+
+    for (i = 0; i < MAX_SENSORS; i++)
+        status.temp[i] = rs->temp_result[i];
+
+    for (i = 0; i < MAX_FANS; i++)
+    {
+        status.rpm[i] = rs->tach_rpm[i];
+        status.duty[i] = rs->fan_duty[i];
+    }
+
+    telemetry_send((uint8_t *)&status, sizeof(status));
+}
+
+uint8_t modbus_read_input(uint16_t reg, uint16_t *val)
+{
+    sys_runstate_t *rs = &_g_rs;
+
+    if (reg >= MODBUS_IR_TEMP && reg < MODBUS_IR_TEMP + MAX_SENSORS)
+        *val = rs->temp_result[reg - MODBUS_IR_TEMP];
+    else if (reg >= MODBUS_IR_RPM && reg < MODBUS_IR_RPM + MAX_FANS)
+        *val = rs->tach_rpm[reg - MODBUS_IR_RPM];
+    else if (reg >= MODBUS_IR_DUTY && reg < MODBUS_IR_DUTY + MAX_FANS)
+        *val = pwm_counts_to_pct(rs->fan_duty[reg - MODBUS_IR_DUTY]);
+    else if (reg == MODBUS_IR_STATE)
+        *val = rs->sensor_state;
+    else if (reg == MODBUS_IR_SENSORS)
+        *val = rs->num_sensors;
+    else
+        return MODBUS_EX_ADDRESS;
+
+    return MODBUS_OK;
+}
+
+uint8_t modbus_read_holding(uint16_t reg, uint16_t *val)
+{
+    return configuration_read_reg(&_g_cfg, reg, val);
+}
+
+uint8_t modbus_write_holding(uint16_t reg, uint16_t val)
+{
+    uint16_t old;
+    uint8_t ret;
+
+    /* Not a setting. The command register, or an error */
+    if (configuration_read_reg(&_g_cfg, reg, &old) != MODBUS_OK)
+        return configuration_write_reg(&_g_cfg, reg, val);
+
+    /* Masters often rewrite the same values. Only a change restarts the PID */
+    ret = configuration_write_reg(&_g_cfg, reg, val);
+
+    if (ret == MODBUS_OK && old != val)
+        apply_configuration(&_g_rs, &_g_cfg);
+
+    return ret;
+}
+
 static void print_temp(uint8_t temp, int16_t dec, const char *desc, uint8_t nl)
 {
     fixedpoint_sign(dec, dec);
@@ -512,24 +1089,183 @@ static void print_temp(uint8_t temp, int16_t dec, const char *desc, uint8_t nl)
         desc, dots_for(desc), fixedpoint_arg(dec, dec));
 }
 
-static void print_fan(uint8_t fan, uint16_t tach_rpm, uint8_t nl)
+static void print_fan(uint8_t fan, uint16_t tach_rpm, uint16_t target_rpm, uint8_t nl)
 {
-    printf("%sFan %c RPM  ....................: ", nl ? "\r\n" : "", '1' + fan);
-    printf("%u\r\n", tach_rpm);
+    stall_t *stall = &_g_rs.stall[fan];
+
+    printf("%sFan %c RPM  ....................: %u", nl ? "\r\n" : "", '1' + fan, tach_rpm);
+
+    if (target_rpm)
+        printf(" (target %u)", target_rpm);
+
+    if (stall->state == STALL_FAULT)
+        printf(" FAULT");
+    else if (stall->state != STALL_OK)
+        printf(" (restarting, attempt %u)", stall->tries);
+
+    printf("\r\n");
 }
 
-static void print_duty(uint8_t duty)
+static void print_duty(uint16_t duty)
 {
-    printf("PWM Duty ......................: %d%%\r\n", duty);
+    printf("PWM Duty ......................: %d%%\r\n", pwm_counts_to_pct(duty));
 }
 
-static void fan_set_duty(uint8_t pwm, uint8_t pct)
+static void fan_set_duty(uint8_t pwm, uint16_t duty)
 {
     if (pwm == FAN1)
-        pwm_setduty(FAN1, pct);
+        pwm_setduty(FAN1, duty);
     
     if (pwm == FAN2)
-        pwm_setduty(FAN2, pct);
+        pwm_setduty(FAN2, duty);
+}
+
+/* Applies the curve output. When holding a speed it becomes a target for task_rpmctl() */
+static void fan_demand(uint8_t fan, uint16_t duty, uint16_t maxrpm)
+{
+    sys_runstate_t *rs = &_g_rs;
+
+    rs->fan_demand[fan] = duty;
+
+    if (maxrpm && duty)
+    {
+        rs->rpm_target[fan] = ((uint32_t)duty * maxrpm) >> PWM_BITS;
+        return;
+    }
+
+    rs->rpm_target[fan] = 0;
+    rs->rpm_integ[fan] = 0;
+
+    if (fan_forced(rs, fan))
+        return;
+
+    rs->fan_duty[fan] = duty;
+    fan_set_duty(fan, duty);
+}
+
+/* Stall recovery has the fan at max. Control output is held off until it lets go */
+static bool fan_forced(sys_runstate_t *rs, uint8_t fan)
+{
+    return rs->stall[fan].state == STALL_KICK || rs->stall[fan].state == STALL_FAULT;
+}
+
+/*
+ * Called once per second per fan. A stalled fan is run at max for a
+ * few seconds, then handed back and watched. If it stalls again the
+ * next attempt waits twice as long as the last, and after
+ * STALL_MAX_TRIES the fan is latched at max as faulty.
+ */
+static void stall_check(sys_runstate_t *rs, uint8_t fan, uint16_t minrpm, uint16_t duty_max)
+{
+    stall_t *stall = &rs->stall[fan];
+    bool stalled = rs->tach_rpm[fan] < minrpm;
+
+    if (stall->timer)
+        stall->timer--;
+
+    switch (stall->state)
+    {
+    case STALL_OK:
+        if (!stalled)
+            break;
+        printf("Fan %u stall. Restarting...\r\n", fan + 1);
+        /* Fall through */
+    case STALL_BACKOFF:
+        if (stall->timer)
+            break;
+        stall->tries++;
+        stall->state = STALL_KICK;
+        stall->timer = STALL_KICK_TIME;
+        rs->fan_duty[fan] = duty_max;
+        pwm_setduty_now(fan, duty_max);  /* Not slewed, or a slow ramp eats the kick */
+        break;
+    case STALL_KICK:
+        if (stall->timer)
+            break;
+        /* The control loop picks it back up on its next pass */
+        stall->state = STALL_VERIFY;
+        stall->timer = STALL_VERIFY_TIME;
+        break;
+    case STALL_VERIFY:
+        if (stalled)
+        {
+            if (stall->tries >= STALL_MAX_TRIES)
+            {
+                printf("Fan %u failed to restart. Holding at max\r\n", fan + 1);
+                stall->state = STALL_FAULT;
+                rs->fan_duty[fan] = duty_max;
+                pwm_setduty_now(fan, duty_max);
+                break;
+            }
+
+            stall->state = STALL_BACKOFF;
+            stall->timer = STALL_BACKOFF_TIME << (stall->tries - 1);
+            printf("Fan %u failed to restart. Retrying in %us\r\n", fan + 1, stall->timer);
+        }
+        else if (!stall->timer)
+        {
+            printf("Fan %u restarted\r\n", fan + 1);
+            stall->state = STALL_OK;
+            stall->tries = 0;
+        }
+        break;
+    case STALL_FAULT:
+        break;
+    }
+}
+
+/*
+ * PI loop around the curve output, which is used as feed forward.
+ * Integration stops while the output is saturated in the direction
+ * of the error, so a fan that can't reach its target doesn't wind up.
+ */
+static uint16_t rpm_control(sys_runstate_t *rs, uint8_t fan)
+{
+    int32_t err = (int32_t)rs->rpm_target[fan] - rs->tach_rpm[fan];
+    int32_t integ;
+    int32_t duty;
+
+    if (err > RPM_ERR_MAX)
+        err = RPM_ERR_MAX;
+    if (err < -RPM_ERR_MAX)
+        err = -RPM_ERR_MAX;
+
+    integ = rs->rpm_integ[fan] + (err * RPM_KI);
+
+    if (integ > RPM_INTEG_MAX)
+        integ = RPM_INTEG_MAX;
+    if (integ < -RPM_INTEG_MAX)
+        integ = -RPM_INTEG_MAX;
+
+    duty = ((int32_t)rs->fan_demand[fan] << RPM_FRAC_BITS) + (err * RPM_KP) + integ;
+
+    if (!((duty > ((int32_t)PWM_BASE << RPM_FRAC_BITS) && err > 0) ||
+            (duty < (RPM_DUTY_MIN << RPM_FRAC_BITS) && err < 0)))
+        rs->rpm_integ[fan] = integ;
+
+    duty = (duty + (1 << (RPM_FRAC_BITS - 1))) >> RPM_FRAC_BITS;
+
+    if (duty > PWM_BASE)
+        duty = PWM_BASE;
+    if (duty < RPM_DUTY_MIN)
+        duty = RPM_DUTY_MIN;
+
+    return duty;
+}
+
+static void task_rpmctl(void)
+{
+    sys_runstate_t *rs = &_g_rs;
+    uint8_t i;
+
+    for (i = 0; i < MAX_FANS; i++)
+    {
+        if (!rs->rpm_target[i] || fan_forced(rs, i))
+            continue;
+
+        rs->fan_duty[i] = rpm_control(rs, i);
+        fan_set_duty(i, rs->fan_duty[i]);
+    }
 }
 
 static char *dots_for(const char *str)
@@ -542,21 +1278,61 @@ static char *dots_for(const char *str)
     return _g_dotBuf;
 }
 
-static uint8_t calc_pwm_duty(int16_t measured, uint8_t pct_max, uint8_t pct_min, int16_t temp_max,
-        int16_t temp_min, uint16_t hyst, uint8_t min_off, bool *hyst_lockout)
+/* (100 << 8) / dt for dt of 1 to PID_DT_MAX, for the PID derivative */
+static const uint16_t _g_ctl_dt_inv[PID_DT_MAX] PROGMEM = {
+    25600, 12800, 8533, 6400, 5120, 4266, 3657, 3200, 2844, 2560,
+    2327, 2133, 1969, 1828, 1706, 1600, 1505, 1422, 1347, 1280,
+    1219, 1163, 1113, 1066, 1024, 984, 948, 914, 882, 853,
+    825, 800, 775, 752, 731, 711, 691, 673, 656, 640,
+    624, 609, 595, 581, 568, 556, 544, 533, 522, 512,
+    501, 492, 483, 474, 465, 457, 449, 441, 433, 426,
+    419, 412, 406, 400, 393, 387, 382, 376, 371, 365,
+    360, 355, 350, 345, 341, 336, 332, 328, 324, 320,
+    316, 312, 308, 304, 301, 297, 294, 290, 287, 284,
+    281, 278, 275, 272, 269, 266, 263, 261, 258, 256,
+    253, 250, 248, 246, 243, 241, 239, 237, 234, 232,
+    230, 228, 226, 224, 222, 220, 218, 216, 215, 213,
+    211, 209, 208, 206, 204, 203, 201, 200, 198, 196,
+    195, 193, 192, 191, 189, 188, 186, 185, 184, 182,
+    181, 180, 179, 177, 176, 175, 174, 172, 171, 170,
+    169, 168, 167, 166, 165, 164, 163, 162, 161, 160,
+    159, 158, 157, 156, 155, 154, 153, 152, 151, 150,
+    149, 148, 147, 147, 146, 145, 144, 143, 143, 142,
+    141, 140, 139, 139, 138, 137, 136, 136, 135, 134,
+    134, 133, 132, 131, 131, 130, 129, 129, 128, 128,
+};
+
+/*
+ * Time since the last control pass. Conversions are paced by the
+ * sensors and polled a tick at a time, so this moves by a tick or so
+ * on most passes. The reciprocal comes from a table rather than a
+ * divide.
+ */
+static void update_ctl_dt(sys_runstate_t *rs)
+{
+    uint16_t now = sched_now();
+    uint16_t dt = now - rs->ctl_last;
+
+    rs->ctl_last = now;
+
+    if (dt > PID_DT_MAX)
+        dt = PID_DT_MAX;
+
+    rs->ctl_dt = dt;
+    rs->ctl_dt_inv = dt ? pgm_read_word(&_g_ctl_dt_inv[dt - 1]) : 0;
+}
+
+static uint16_t calc_duty(uint8_t zone, int16_t measured, int16_t temp_max, int16_t temp_min, uint16_t hyst,
+        uint8_t min_off, int16_t setpoint, bool *hyst_lockout)
 {
-    int16_t temprange = temp_max - temp_min;
-    int16_t pctrange = pct_max - pct_min;
-    int16_t actual;
-    int16_t percent;
-    int16_t result;
-    int16_t scaled;
+    sys_runstate_t *rs = &_g_rs;
 
     if (min_off)
     {
         if (measured < (temp_min - hyst))
         {
             *hyst_lockout = true;
+            rs->pid[zone].primed = false;
             return 0;
         }
 
@@ -568,20 +1344,189 @@ static uint8_t calc_pwm_duty(int16_t measured, uint8_t pct_max, uint8_t pct_min,
                 return 0;
         }
     }
-    
-    if (measured < temp_min)
-        measured = temp_min;
 
-    if (measured > temp_max)
-        measured = temp_max;
+    if (_g_cfg.ctl_mode == CTL_MODE_PID)
+        return calc_pid_duty(&rs->pid[zone], &rs->ramp[zone], measured, setpoint);
 
-    actual = measured - temp_min;
-    percent = (actual * 100) / temprange;
-    scaled = pctrange * percent;
-    
-    result = pct_min + (scaled / 100);
-    if (result > pct_max)
-        result = pct_max;
+    if (_g_cfg.ctl_mode == CTL_MODE_CURVE)
+        return calc_curve_duty(&rs->curve[zone], &rs->ramp[zone], measured);
+
+    return calc_pwm_duty(&rs->ramp[zone], measured, temp_max, temp_min);
+}
+
+/* Works out what the control path keeps from the config. Again whenever it changes */
+static void apply_configuration(sys_runstate_t *rs, sys_config_t *config)
+{
+    uint8_t i;
+
+    pwm_set_ramp(config->fan_ramp);
+
+#ifdef _SINGLEZONE_
+    ramp_init(&rs->ramp[0], config->fans_max, config->fans_min, config->temp_max, config->temp_min);
+    curve_init(&rs->curve[0], config->curve_points, config->curve_temp, config->curve_duty);
+#else
+    ramp_init(&rs->ramp[FAN1], config->fan1_max, config->fan1_min, config->temp1_max, config->temp1_min);
+    ramp_init(&rs->ramp[FAN2], config->fan2_max, config->fan2_min, config->temp2_max, config->temp2_min);
+    curve_init(&rs->curve[FAN1], config->curve1_points, config->curve1_temp, config->curve1_duty);
+    curve_init(&rs->curve[FAN2], config->curve2_points, config->curve2_temp, config->curve2_duty);
+#endif /* _SINGLEZONE_ */
+
+    /* The integrator may be from another mode or other gains */
+    for (i = 0; i < MAX_FANS; i++)
+        rs->pid[i].primed = false;
+}
+
+static void ramp_init(ramp_t *ramp, uint8_t pct_max, uint8_t pct_min, int16_t temp_max, int16_t temp_min)
+{
+    uint32_t slope = 0xFFFF;
+
+    ramp->cnt_max = pwm_pct_to_counts(pct_max);
+    ramp->cnt_min = pwm_pct_to_counts(pct_min);
+
+    if (ramp->cnt_max <= ramp->cnt_min)
+        slope = 0;
+    else if (temp_max > temp_min)
+        slope = ((uint32_t)(ramp->cnt_max - ramp->cnt_min) << 8) / (uint16_t)(temp_max - temp_min);
+
+    ramp->slope = slope > 0xFFFF ? 0xFFFF : slope;
+}
+
+static uint16_t calc_pwm_duty(ramp_t *ramp, int16_t measured, int16_t temp_max, int16_t temp_min)
+{
+    uint16_t result;
+
+    if (measured <= temp_min)
+        return ramp->cnt_min;
+
+    if (measured >= temp_max)
+        return ramp->cnt_max;
+
+    result = ramp->cnt_min + (((uint32_t)(uint16_t)(measured - temp_min) * ramp->slope) >> 8);
+    if (result > ramp->cnt_max)
+        result = ramp->cnt_max;
+
+    return result;
+}
+
+/*
+ * Error is positive when too hot. The derivative acts on the
+ * measurement so setpoint changes don't kick the output. The integral
+ * is kept within the output range on its own, and stops accumulating
+ * while the output is saturated in the direction of the error.
+ */
+static uint16_t calc_pid_duty(pid_state_t *pid, ramp_t *ramp, int16_t measured, int16_t setpoint)
+{
+    sys_runstate_t *rs = &_g_rs;
+    sys_config_t *config = &_g_cfg;
+    int32_t lo = counts_to_pid(ramp->cnt_min);
+    int32_t hi = counts_to_pid(ramp->cnt_max);
+    int32_t err = measured - setpoint;
+    int32_t deriv;
+    int32_t integ;
+    int32_t out;
+
+    if (!pid->primed)
+    {
+        /* Start from the bottom of the range rather than a step */
+        pid->integ = lo;
+        pid->last = measured;
+        pid->primed = true;
+    }
+
+    if (err > PID_ERR_MAX)
+        err = PID_ERR_MAX;
+    if (err < -PID_ERR_MAX)
+        err = -PID_ERR_MAX;
+
+    integ = pid->integ + ((int32_t)config->pid_ki * err * rs->ctl_dt);
+
+    if (integ > hi)
+        integ = hi;
+    if (integ < lo)
+        integ = lo;
+
+    /* Anything bigger saturates even at the longest dt */
+    deriv = (int32_t)config->pid_kd * (measured - pid->last);
+
+    if (deriv > (PID_DERIV_MAX * PID_DT_MAX) / 100)
+        deriv = (PID_DERIV_MAX * PID_DT_MAX) / 100;
+    if (deriv < -(PID_DERIV_MAX * PID_DT_MAX) / 100)
+        deriv = -(PID_DERIV_MAX * PID_DT_MAX) / 100;
+
+    /* 1/100 % */
+    deriv = (deriv * rs->ctl_dt_inv) >> 8;
+
+    if (deriv > PID_DERIV_MAX)
+        deriv = PID_DERIV_MAX;
+    if (deriv < -PID_DERIV_MAX)
+        deriv = -PID_DERIV_MAX;
+
+    pid->last = measured;
+
+    out = ((int32_t)config->pid_kp * err * 100) + integ + (deriv * 100);
+
+    if (!((out > hi && err > 0) || (out < lo && err < 0)))
+        pid->integ = integ;
+
+    if (out > hi)
+        out = hi;
+    if (out < lo)
+        out = lo;
+
+    return pid_to_counts(out);
+}
+
+static void curve_init(curve_t *curve, uint8_t points, int16_t *temp, uint8_t *duty)
+{
+    uint8_t i;
+
+    curve->points = points;
+    curve->temp = temp;
+
+    for (i = 0; i < points; i++)
+        curve->cnt[i] = pwm_pct_to_counts(duty[i]);
+
+    for (i = 0; i + 1 < points; i++)
+    {
+        curve->slope[i] = ((int32_t)(curve->cnt[i + 1] - curve->cnt[i]) << CURVE_SLOPE_SHIFT) /
+                (temp[i + 1] - temp[i]);
+    }
+}
+
+/*
+ * Find the segment, then one multiply. Flat beyond either end.
+ */
+static uint16_t calc_curve_duty(curve_t *curve, ramp_t *ramp, int16_t measured)
+{
+    uint8_t last = curve->points - 1;
+    uint8_t i;
+    int16_t result;
+
+    /* No curve set */
+    if (curve->points < 2)
+        return ramp->cnt_max;
+
+    if (measured <= curve->temp[0])
+    {
+        result = curve->cnt[0];
+    }
+    else if (measured >= curve->temp[last])
+    {
+        result = curve->cnt[last];
+    }
+    else
+    {
+        for (i = 0; measured >= curve->temp[i + 1]; i++)
+            ;
+
+        result = curve->cnt[i] + (int16_t)(((int32_t)(measured - curve->temp[i]) * curve->slope[i] +
+                (1L << (CURVE_SLOPE_SHIFT - 1))) >> CURVE_SLOPE_SHIFT);
+    }
+
+    if (result > (int16_t)ramp->cnt_max)
+        result = ramp->cnt_max;
+    if (result < (int16_t)ramp->cnt_min)
+        result = ramp->cnt_min;
 
     return result;
 }
@@ -0,0 +1,289 @@
+/*
+ *   File:   modbus.c
+ *   Author: Matthew Millman
+ *
+ *   Fan speed controller. OSS AVR Version.
+ *
+ *   Modbus RTU slave on the console UART
+ *
+ *   Created on 17 October 2026, 20:10
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <util/crc16.h>
+
+#include "usart.h"
+#include "timer.h"
+#include "util.h"
+#include "modbus.h"
+
+/*
+ * Frames are told apart by the gap between them: 3.5 characters of
+ * quiet, or 1.75ms above 19200 baud. The RX interrupt stamps each byte
+ * with Timer2 and marks the ones that follow a gap, so modbus_poll()
+ * can split frames that arrive in the same tick. On a multi-drop bus
+ * another slave's request and reply can be followed straight away by
+ * ours, so waiting for the line to go quiet for a tick or two isn't
+ * enough.
+ *
+ * The stamps are taken as each byte finishes, so between two of them
+ * the quiet time is a character shorter. Half a character is left as
+ * margin for interrupt latency.
+ *
+ * A direction-switching RS-485 transceiver is assumed, as nothing here
+ * drives DE.
+ */
+
+#define MODBUS_CHAR_BITS     10      /* 8N1 */
+#define MODBUS_GAP_FIXED_US  1750
+#define MODBUS_MAX_FRAME     (9 + MODBUS_MAX_REGS * 2)   /* Write multiple */
+
+#define MODBUS_READ_HOLDING  0x03
+#define MODBUS_READ_INPUT    0x04
+#define MODBUS_WRITE_SINGLE  0x06
+#define MODBUS_WRITE_MULTI   0x10
+
+#define MODBUS_BROADCAST     0
+
+static uint8_t _g_mb_addr;
+static uint8_t _g_mb_frame[MODBUS_MAX_FRAME];
+static uint8_t _g_mb_len;
+static bool _g_mb_overrun;
+
+/* Timer2 counts from one byte's interrupt to the next that mean a frame gap */
+static uint16_t modbus_gap(uint32_t baud)
+{
+    uint32_t chr = (TIMER2_HZ * MODBUS_CHAR_BITS + baud / 2) / baud;
+    uint32_t gap;
+
+    if (baud > 19200)
+        gap = (TIMER2_HZ / 1000) * MODBUS_GAP_FIXED_US / 1000;
+    else
+        gap = chr * 7 / 2;
+
+    return gap + chr / 2;
+}
+
+void modbus_init(uint8_t addr, uint32_t baud)
+{
+    _g_mb_addr = addr;
+    _g_mb_len = 0;
+    _g_mb_overrun = false;
+
+    console_set_rx_gap(modbus_gap(baud));
+}
+
+static uint16_t modbus_crc(const uint8_t *data, uint8_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (len--)
+        crc = _crc16_update(crc, *data++);
+
+    return crc;
+}
+
+static uint16_t modbus_u16(const uint8_t *data)
+{
+    return ((uint16_t)data[0] << 8) | data[1];
+}
+
+/* CRC goes out low byte first, unlike everything else */
+static void modbus_send(uint8_t *data, uint8_t len)
+{
+    uint16_t crc = modbus_crc(data, len);
+    uint8_t i;
+
+    for (i = 0; i < len; i++)
+        console_put(data[i]);
+
+    console_put(crc & 0xFF);
+    console_put(crc >> 8);
+}
+
+static void modbus_exception(uint8_t func, uint8_t code)
+{
+    uint8_t data[3];
+
+    data[0] = _g_mb_addr;
+    data[1] = func | 0x80;
+    data[2] = code;
+
+    modbus_send(data, sizeof(data));
+}
+
+/* Replies in place, in _g_mb_frame. Returns the exception code */
+static uint8_t modbus_read(uint8_t func, uint8_t *len)
+{
+    uint8_t *frame = _g_mb_frame;
+    uint16_t start;
+    uint16_t count;
+    uint16_t val;
+    uint8_t ret;
+    uint8_t i;
+
+    if (*len != 6)
+        return MODBUS_EX_VALUE;
+
+    start = modbus_u16(&frame[2]);
+    count = modbus_u16(&frame[4]);
+
+    if (count == 0 || count > MODBUS_MAX_REGS)
+        return MODBUS_EX_VALUE;
+
+    for (i = 0; i < count; i++)
+    {
+        if (func == MODBUS_READ_INPUT)
+            ret = modbus_read_input(start + i, &val);
+        else
+            ret = modbus_read_holding(start + i, &val);
+
+        if (ret != MODBUS_OK)
+            return ret;
+
+        frame[3 + i * 2] = val >> 8;
+        frame[4 + i * 2] = val;
+    }
+
+    frame[2] = count * 2;
+    *len = 3 + count * 2;
+
+    return MODBUS_OK;
+}
+
+/* Registers are checked and written one at a time. A bad one stops the rest */
+static uint8_t modbus_write(uint8_t func, uint8_t *len, bool *restart)
+{
+    uint8_t *frame = _g_mb_frame;
+    uint16_t start;
+    uint16_t count;
+    uint8_t ret;
+    uint8_t i;
+
+    start = modbus_u16(&frame[2]);
+
+    if (func == MODBUS_WRITE_SINGLE)
+    {
+        if (*len != 6)
+            return MODBUS_EX_VALUE;
+
+        ret = modbus_write_holding(start, modbus_u16(&frame[4]));
+    }
+    else
+    {
+        if (*len < 7)
+            return MODBUS_EX_VALUE;
+
+        count = modbus_u16(&frame[4]);
+
+        if (count == 0 || count > MODBUS_MAX_REGS || frame[6] != count * 2 || *len != 7 + count * 2)
+            return MODBUS_EX_VALUE;
+
+        ret = MODBUS_OK;
+
+        for (i = 0; i < count && (ret == MODBUS_OK || ret == MODBUS_RESET); i++)
+            ret = modbus_write_holding(start + i, modbus_u16(&frame[7 + i * 2]));
+
+        /* Reply is the start and count, which are already there */
+        *len = 6;
+    }
+
+    if (ret == MODBUS_RESET)
+    {
+        *restart = true;
+        ret = MODBUS_OK;
+    }
+
+    return ret;
+}
+
+static void modbus_process(void)
+{
+    uint8_t *frame = _g_mb_frame;
+    uint8_t len = _g_mb_len;
+    bool restart = false;
+    uint8_t ret;
+
+    if (len < 4 || modbus_crc(frame, len))
+        return;                         /* Noise, or someone else's reply. Stay quiet */
+
+    if (frame[0] != _g_mb_addr && frame[0] != MODBUS_BROADCAST)
+        return;
+
+    len -= 2;
+
+    switch (frame[1])
+    {
+    case MODBUS_READ_HOLDING:
+    case MODBUS_READ_INPUT:
+        ret = modbus_read(frame[1], &len);
+        break;
+    case MODBUS_WRITE_SINGLE:
+    case MODBUS_WRITE_MULTI:
+        ret = modbus_write(frame[1], &len, &restart);
+        break;
+    default:
+        ret = MODBUS_EX_FUNCTION;
+        break;
+    }
+
+    /* Broadcasts are never answered */
+    if (frame[0] != MODBUS_BROADCAST)
+    {
+        if (ret == MODBUS_OK)
+            modbus_send(frame, len);
+        else
+            modbus_exception(frame[1], ret);
+    }
+
+    if (restart)
+    {
+        while (console_busy());
+        reset();
+    }
+}
+
+/* Call every scheduler tick */
+void modbus_poll(void)
+{
+    uint8_t c;
+
+    for (;;)
+    {
+        /* A gap before the next byte, or since the last one, ends the frame */
+        if (_g_mb_len && console_rx_gap())
+        {
+            /* Too long to be anything we answer to */
+            if (!_g_mb_overrun)
+                modbus_process();
+
+            _g_mb_len = 0;
+            _g_mb_overrun = false;
+        }
+
+        if (!console_data_ready())
+            break;
+
+        c = console_get();
+
+        if (_g_mb_len < sizeof(_g_mb_frame))
+            _g_mb_frame[_g_mb_len++] = c;
+        else
+            _g_mb_overrun = true;
+    }
+}
@@ -0,0 +1,74 @@
+/*
+ *   File:   modbus.h
+ *   Author: Matthew Millman
+ *
+ *   Fan speed controller. OSS AVR Version.
+ *
+ *   Modbus RTU slave on the console UART
+ *
+ *   Created on 17 October 2026, 20:10
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MODBUS_H__
+#define __MODBUS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MODBUS_ADDR_MAX      247
+#define MODBUS_MAX_REGS      16      /* Per request */
+
+/* Exception codes. MODBUS_OK isn't one, and MODBUS_RESET means OK, then reset once replied */
+#define MODBUS_OK            0x00
+#define MODBUS_EX_FUNCTION   0x01
+#define MODBUS_EX_ADDRESS    0x02
+#define MODBUS_EX_VALUE      0x03
+#define MODBUS_RESET         0xFF
+
+/*
+ * Input registers (function 4)
+ *
+ * 0x0000 + n   Temperature n, 0.1 degree, signed. Only valid if bit n
+ *              of the sensor state is set
+ * 0x0010 + n   Fan n RPM
+ * 0x0020 + n   Fan n duty, %
+ * 0x0030       Sensor state. Bit per sensor
+ * 0x0031       Number of sensors
+ *
+ * Holding registers (functions 3, 6 and 16) are the scalar settings
+ * in sys_config_t, in the order the console 'show' command lists them.
+ * See configuration_read_reg(). Writes change the running copy only.
+ *
+ * 0x0100       Command. Write 1 to save settings to EEPROM, 2 to save
+ *              and restart so they take effect
+ */
+#define MODBUS_IR_TEMP       0x0000
+#define MODBUS_IR_RPM        0x0010
+#define MODBUS_IR_DUTY       0x0020
+#define MODBUS_IR_STATE      0x0030
+#define MODBUS_IR_SENSORS    0x0031
+#define MODBUS_HR_COMMAND    0x0100
+
+#define MODBUS_CMD_SAVE      1
+#define MODBUS_CMD_RESTART   2
+
+void modbus_init(uint8_t addr, uint32_t baud);
+void modbus_poll(void);
+
+/* Provided by the application */
+uint8_t modbus_read_input(uint16_t reg, uint16_t *val);
+uint8_t modbus_read_holding(uint16_t reg, uint16_t *val);
+uint8_t modbus_write_holding(uint16_t reg, uint16_t val);
+
+#endif /* __MODBUS_H__ */
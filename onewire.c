@@ -20,6 +20,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "config.h"
 #include "onewire.h"
@@ -68,17 +69,17 @@ static bool onewire_find_device(uint8_t *diff, uint8_t *id, uint8_t *family_code
     return true;
 }
 
-bool onewire_search_devices(uint8_t(*sensor_ids)[OW_ROMCODE_SIZE], uint8_t *family_codes, uint8_t *counts, uint8_t family_codes_len)
+/* Adds to counts. *total gets the number of ids stored, up to max */
+static bool onewire_search(uint8_t(*sensor_ids)[OW_ROMCODE_SIZE], uint8_t *family_codes, uint8_t *counts,
+        uint8_t family_codes_len, uint8_t max, uint8_t *total)
 {
     bool presense;
     uint8_t i;
-    uint8_t total = 0;
     uint8_t id[OW_ROMCODE_SIZE];
     uint8_t diff;
-    
-    for (i = 0; i < family_codes_len; i++)
-        counts[i] = 0;
-    
+
+    *total = 0;
+
     if (!ow_bus_reset(&presense))
         return false;
     if (!presense)
@@ -86,7 +87,7 @@ bool onewire_search_devices(uint8_t(*sensor_ids)[OW_ROMCODE_SIZE], uint8_t *fami
     
     diff = OW_SEARCH_FIRST;
 
-    while (diff != OW_LAST_DEVICE && total < MAX_SENSORS)
+    while (diff != OW_LAST_DEVICE && *total < max)
     {
         int8_t family_matched;
 
@@ -106,10 +107,151 @@ bool onewire_search_devices(uint8_t(*sensor_ids)[OW_ROMCODE_SIZE], uint8_t *fami
         counts[family_matched]++;
         
         for (i = 0; i < OW_ROMCODE_SIZE; i++)
-            sensor_ids[total][i] = id[i];
+            sensor_ids[*total][i] = id[i];
+
+        (*total)++;
+    }
+
+    return true;
+}
+
+bool onewire_search_devices(uint8_t(*sensor_ids)[OW_ROMCODE_SIZE], uint8_t *family_codes, uint8_t *counts, uint8_t family_codes_len)
+{
+    uint8_t total;
+    uint8_t i;
+
+    for (i = 0; i < family_codes_len; i++)
+        counts[i] = 0;
+
+    return onewire_search(sensor_ids, family_codes, counts, family_codes_len, MAX_SENSORS, &total);
+}
+
+#ifdef _OW_DS2482_800_
+
+/*
+ * As onewire_search_devices(), across every DS2482-800 channel.
+ * channels[] gets the channel each id was found on, so the ids come
+ * out grouped by channel.
+ */
+bool onewire_search_channels(uint8_t(*sensor_ids)[OW_ROMCODE_SIZE], uint8_t *channels, uint8_t *family_codes,
+        uint8_t *counts, uint8_t family_codes_len)
+{
+    uint8_t total = 0;
+    uint8_t found;
+    uint8_t ch;
+    uint8_t i;
+
+    for (i = 0; i < family_codes_len; i++)
+        counts[i] = 0;
+
+    for (ch = 0; ch < DS2482_CHANNELS && total < MAX_SENSORS; ch++)
+    {
+        if (!ds2482_select_channel(ch))
+            return false;
+
+        if (!onewire_search(sensor_ids + total, family_codes, counts, family_codes_len, MAX_SENSORS - total, &found))
+            return false;
+
+        while (found--)
+            channels[total++] = ch;
+    }
+
+    return true;
+}
+
+/* Which channel a known device is on */
+bool onewire_find_channel(const uint8_t *id, uint8_t *channel)
+{
+    uint8_t found[OW_ROMCODE_SIZE];
+    uint8_t diff;
+    uint8_t ch;
+
+    for (ch = 0; ch < DS2482_CHANNELS; ch++)
+    {
+        if (!ds2482_select_channel(ch))
+            return false;
+
+        diff = OW_SEARCH_FIRST;
+
+        while (diff != OW_LAST_DEVICE)
+        {
+            diff = ow_rom_search(diff, found);
+
+            if (diff == OW_COMMS_ERR)
+                return false;
+
+            if (diff == OW_PRESENCE_ERR || diff == OW_DATA_ERR)
+                break;
+
+            if (!memcmp(found, id, OW_ROMCODE_SIZE))
+            {
+                *channel = ch;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+#endif /* _OW_DS2482_800_ */
+
+/*
+ * Walks every device on the bus regardless of family. *single is
+ * cleared if anything outside family_codes answers, or if the
+ * search can't complete cleanly.
+ */
+bool onewire_single_family(uint8_t *family_codes, uint8_t family_codes_len, bool *single)
+{
+    uint8_t id[OW_ROMCODE_SIZE];
+    uint8_t diff = OW_SEARCH_FIRST;
+
+    *single = true;
+
+    while (diff != OW_LAST_DEVICE)
+    {
+        diff = ow_rom_search(diff, id);
+
+        if (diff == OW_COMMS_ERR)
+            return false;
+
+        if (diff == OW_PRESENCE_ERR)
+            break;
 
-        total++;
+        if (diff == OW_DATA_ERR || match_family_code(id[0], family_codes, family_codes_len) < 0)
+        {
+            *single = false;
+            break;
+        }
     }
 
     return true;
 }
+
+/* Families that take Overdrive Match ROM */
+bool onewire_overdrive_capable(uint8_t family_code)
+{
+    switch (family_code)
+    {
+    case 0x2D: /* DS2431 */
+    case 0x42: /* DS28EA00 */
+    case 0x43: /* DS28EC20 */
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Match ROM, at overdrive speed if the device can do it. The bus goes
+ * back to standard speed on the next select or search.
+ */
+bool onewire_select(const uint8_t *id)
+{
+#ifdef _OW_OVERDRIVE_
+    if (id && onewire_overdrive_capable(id[0]))
+        return ow_select_od(id);
+#endif /* _OW_OVERDRIVE_ */
+
+    return ow_select(id);
+}
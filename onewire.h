@@ -23,6 +23,8 @@
 #define OW_MATCH_ROM    0x55
 #define OW_SKIP_ROM     0xCC
 #define OW_SEARCH_ROM   0xF0
+#define OW_OD_SKIP_ROM  0x3C        /* Sent at standard speed, devices then switch to overdrive */
+#define OW_OD_MATCH_ROM 0x69        /* As above, ROM code follows at overdrive speed */
 
 #define OW_SEARCH_FIRST 0xFF        /* Start new search */
 #define OW_PRESENCE_ERR 0xFF
@@ -31,12 +33,20 @@
 #define OW_LAST_DEVICE  0x00        /* Last device found */
 
 bool onewire_search_devices(uint8_t(*sensor_ids)[OW_ROMCODE_SIZE], uint8_t *family_codes, uint8_t *counts, uint8_t family_codes_len);
+#ifdef _OW_DS2482_800_
+bool onewire_search_channels(uint8_t(*sensor_ids)[OW_ROMCODE_SIZE], uint8_t *channels, uint8_t *family_codes, uint8_t *counts, uint8_t family_codes_len);
+bool onewire_find_channel(const uint8_t *id, uint8_t *channel);
+#endif /* _OW_DS2482_800_ */
+bool onewire_single_family(uint8_t *family_codes, uint8_t family_codes_len, bool *single);
+bool onewire_overdrive_capable(uint8_t family_code);
+bool onewire_select(const uint8_t *id);
 
 #ifdef _OW_BITBANG_
 
 #define ow_init()
 #define ow_bus_reset(presense) owbitbang_bus_reset(presense)
 #define ow_select(id) owbitbang_select(id)
+#define ow_select_od(id) owbitbang_select_od(id)
 #define ow_write(data, len) owbitbang_write(data, len)
 #define ow_read(data, len) owbitbang_read(data, len)
 #define ow_bit_io(bit) owbitbang_bit_io(bit)
@@ -49,6 +59,7 @@ bool onewire_search_devices(uint8_t(*sensor_ids)[OW_ROMCODE_SIZE], uint8_t *fami
 #define ow_init() ds2482_init()
 #define ow_bus_reset(presense) ds2482_bus_reset(presense)
 #define ow_select(id) ds2482_select(id)
+#define ow_select_od(id) ds2482_select_od(id)
 #define ow_write(data, len) ds2482_write(data, len)
 #define ow_read(data, len) ds2482_read(data, len)
 #define ow_bit_io(bit) ds2482_bit_io(bit)
@@ -0,0 +1,237 @@
+/*
+ *   File:   ow_async.c
+ *   Author: Matthew Millman
+ *
+ *   Fan speed controller. OSS AVR Version.
+ *
+ *   Interrupt driven 1-Wire transactions
+ *
+ *   Created on 17 October 2026, 15:10
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+
+#include "iopins.h"
+#include "config.h"
+#include "timer.h"
+#include "onewire.h"
+#include "ow_async.h"
+
+#if defined(_OW_ASYNC_) && defined(_OW_BITBANG_)
+
+/*
+ * A whole transaction (reset, ROM select, write, read) runs from the
+ * Timer2 compare A interrupt. Each bit slot is handled in one ISR: the
+ * part up to the sample point (~15us) is timed with busy waits, then
+ * the compare is set for the end of the slot. The CPU is free for the
+ * remaining ~70us of every bit, and for the reset apart from the 70us
+ * from release to the presence sample.
+ *
+ * Shares the bus with ow_bitbang.c.
+ */
+
+#define OW_GET_IN()   IO_IN_HIGH(ONEWIRE)
+#define OW_OUT_LOW()  IO_LOW(ONEWIRE)
+#define OW_OUT_HIGH() IO_HIGH(ONEWIRE)
+#define OW_DIR_IN()   IO_INPUT(ONEWIRE)
+#define OW_DIR_OUT()  IO_OUTPUT(ONEWIRE)
+
+/* Timer2 counts, rounded up */
+#define owasync_us(us)       ((uint8_t)(((us) * (TIMER2_HZ / 1000UL) + 999) / 1000))
+
+#define OWA_RESET_LOW        owasync_us(480)
+#define OWA_PRESENCE         70  /* usec. Busy wait in the ISR, see OWA_RESET */
+#define OWA_RESET_REST       owasync_us(410)
+#define OWA_SLOT             owasync_us(60)
+#define OWA_RECOVERY         owasync_us(20)
+
+#define OWA_IDLE             0
+#define OWA_RESET            1   /* Reset pulse being held low */
+#define OWA_SLOT_START       2   /* Next event starts a bit slot */
+#define OWA_SLOT_END         3   /* Next event releases a write 0 */
+
+#define OWA_MAX_TX           (1 + OW_ROMCODE_SIZE + OWASYNC_MAX_WRITE)
+
+static volatile uint8_t _g_state;
+static volatile bool _g_ok;
+static uint8_t _g_tx[OWA_MAX_TX];
+static uint8_t _g_txlen;
+static uint8_t *_g_rbuf;
+static uint8_t _g_rlen;
+static uint8_t _g_pos;               /* Byte being clocked. Writes, then reads */
+static uint8_t _g_mask;
+
+static void owasync_schedule(uint8_t counts)
+{
+    OCR2A = TCNT2 + counts;
+    TIFR2 = _BV(OCF2A);
+}
+
+static void owasync_finish(bool ok)
+{
+    TIMSK2 &= ~_BV(OCIE2A);
+    _g_ok = ok;
+    _g_state = OWA_IDLE;
+}
+
+bool owasync_start(const uint8_t *id, const uint8_t *data, uint8_t wlen, uint8_t *rbuf, uint8_t rlen)
+{
+    uint8_t intsave;
+
+    if (_g_state != OWA_IDLE || wlen > OWASYNC_MAX_WRITE)
+        return false;
+
+    _g_txlen = 0;
+
+    if (id)
+    {
+        _g_tx[_g_txlen++] = OW_MATCH_ROM;
+        memcpy(&_g_tx[_g_txlen], id, OW_ROMCODE_SIZE);
+        _g_txlen += OW_ROMCODE_SIZE;
+    }
+    else
+    {
+        _g_tx[_g_txlen++] = OW_SKIP_ROM;
+    }
+
+    memcpy(&_g_tx[_g_txlen], data, wlen);
+    _g_txlen += wlen;
+
+    memset(rbuf, 0, rlen);
+    _g_rbuf = rbuf;
+    _g_rlen = rlen;
+    _g_pos = 0;
+    _g_mask = 0x01;
+    _g_ok = false;
+
+    intsave = (SREG & _BV(SREG_I)) == _BV(SREG_I);
+    g_irq_disable();
+
+    OW_OUT_LOW();
+    OW_DIR_OUT();
+    _g_state = OWA_RESET;
+    owasync_schedule(OWA_RESET_LOW);
+    TIMSK2 |= _BV(OCIE2A);
+
+    if (intsave)
+        g_irq_enable();
+
+    return true;
+}
+
+bool owasync_busy(void)
+{
+    return _g_state != OWA_IDLE;
+}
+
+bool owasync_result(void)
+{
+    return _g_ok;
+}
+
+ISR(TIMER2_COMPA_vect)
+{
+    uint8_t start;
+    uint8_t bit;
+
+    switch (_g_state)
+    {
+    case OWA_RESET:
+        /*
+         * Presence is only sure to be low from 60 to 75us after release.
+         * A second compare could be held past that by other ISRs, so the
+         * sample is timed here with them still masked.
+         */
+        OW_DIR_IN();
+        OW_OUT_HIGH();
+        _delay_us(OWA_PRESENCE);
+
+        if (OW_GET_IN())
+        {
+            owasync_finish(false);
+            break;
+        }
+
+        _g_state = OWA_SLOT_START;
+        owasync_schedule(OWA_RESET_REST);
+        break;
+
+    case OWA_SLOT_START:
+        if (_g_pos < _g_txlen)
+            bit = _g_tx[_g_pos] & _g_mask;
+        else
+            bit = 1;                /* Read slot */
+
+        start = TCNT2;
+        OW_OUT_LOW();
+        OW_DIR_OUT();
+        _delay_us(2);
+
+        if (bit)
+        {
+            OW_DIR_IN();
+            OW_OUT_HIGH();
+        }
+
+        _delay_us(15-2);
+
+        if (_g_pos >= _g_txlen && OW_GET_IN())
+            _g_rbuf[_g_pos - _g_txlen] |= _g_mask;
+
+        _g_mask <<= 1;
+        if (!_g_mask)
+        {
+            _g_mask = 0x01;
+            _g_pos++;
+        }
+
+        if (!bit)
+        {
+            /* Relative to the slot start, so a late ISR can't stretch the low time */
+            _g_state = OWA_SLOT_END;
+            OCR2A = start + OWA_SLOT;
+            TIFR2 = _BV(OCF2A);
+            break;
+        }
+
+        if (_g_pos == _g_txlen + _g_rlen)
+            owasync_finish(true);
+        else
+            owasync_schedule(OWA_SLOT - (uint8_t)(TCNT2 - start) + OWA_RECOVERY);
+        break;
+
+    case OWA_SLOT_END:
+        OW_OUT_HIGH();
+        OW_DIR_IN();
+
+        if (_g_pos == _g_txlen + _g_rlen)
+        {
+            owasync_finish(true);
+            break;
+        }
+
+        _g_state = OWA_SLOT_START;
+        owasync_schedule(OWA_RECOVERY);
+        break;
+    }
+}
+
+#endif /* _OW_ASYNC_ && _OW_BITBANG_ */
@@ -0,0 +1,47 @@
+/*
+ *   File:   ow_async.h
+ *   Author: Matthew Millman
+ *
+ *   Fan speed controller. OSS AVR Version.
+ *
+ *   Interrupt driven 1-Wire transactions
+ *
+ *   Created on 17 October 2026, 15:10
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __OW_ASYNC_H__
+#define __OW_ASYNC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define OWASYNC_MAX_WRITE    4       /* Bytes after the ROM select */
+
+/*
+ * One 1-Wire transaction, run from interrupts. Implemented by ow_async.c
+ * on the bit-bang bus and by ds2482.c on the DS2482. Nothing else may use
+ * the bus while a transaction is running.
+ */
+
+/*
+ * Match ROM (or Skip ROM if id is NULL), write wlen bytes then read
+ * rlen bytes into rbuf. rbuf must stay valid until owasync_busy()
+ * returns false. Returns false if a transaction is already running.
+ */
+bool owasync_start(const uint8_t *id, const uint8_t *data, uint8_t wlen, uint8_t *rbuf, uint8_t rlen);
+bool owasync_busy(void);
+/* Whether the last transaction found a device and ran to the end */
+bool owasync_result(void);
+
+#endif /* __OW_ASYNC_H__ */
@@ -49,15 +49,80 @@
  */
 #define OW_RECOVERY_TIME         20  /* usec */
 
+#define OW_PRESENCE_SAMPLE       70  /* usec after releasing the reset pulse */
+
+#ifdef _OW_OVERDRIVE_
+
+/*
+ * Overdrive timings, Maxim AN126. Set by Overdrive Skip/Match ROM and
+ * cleared by the next standard speed reset, which every select and
+ * search starts with.
+ */
+#define OW_OD_RESET_LOW          70
+#define OW_OD_PRESENCE_SAMPLE    8.5
+#define OW_OD_RESET_REST         40
+#define OW_OD_SAMPLE             1   /* After releasing a read/write 1 */
+#define OW_OD_SLOT               8   /* Write 0 low time */
+#define OW_OD_RECOVERY_TIME      2.5
+
+static bool _g_od;
+
+static uint8_t owbitbang_bit_xch_od(uint8_t b);
+
+#define OW_SPEED_STD()           _g_od = false
+#define OW_SLOT(b)               (_g_od ? owbitbang_bit_xch_od(b) : owbitbang_bit_xch(b))
+
+#else
+
+#define OW_SPEED_STD()
+#define OW_SLOT(b)               owbitbang_bit_xch(b)
+
+#endif /* _OW_OVERDRIVE_ */
+
 bool owbitbang_bus_idle()
 {
     return OW_GET_IN();
 }
 
+/*
+ * Interrupts are only masked from release to the presence sample.
+ * tPDH is 15-60us and tPDL at least 60us, so the line is only sure to
+ * be low from 60 to 75us for every device. An ISR landing in there
+ * would push the 70us sample out of the window. The reset low time
+ * only has a minimum, so ISRs are fine during it.
+ */
 bool owbitbang_bus_reset(bool *presense_detect)
 {
-    bool ret;
     uint8_t intsave;
+    bool ret;
+
+#ifdef _OW_OVERDRIVE_
+    if (_g_od)
+    {
+        /* Far too short to let ISRs in. Low time is 48-80us */
+        intsave = (SREG & _BV(SREG_I)) == _BV(SREG_I);
+        g_irq_disable();
+
+        OW_OUT_LOW();
+        OW_DIR_OUT();
+        _delay_us(OW_OD_RESET_LOW);
+
+        OW_DIR_IN();
+        OW_OUT_HIGH();
+        _delay_us(OW_OD_PRESENCE_SAMPLE);
+        ret = !(OW_GET_IN());
+
+        if (intsave)
+            g_irq_enable();
+
+        _delay_us(OW_OD_RESET_REST);
+        if (OW_GET_IN() == 0)
+            ret = false;
+
+        *presense_detect = ret;
+        return ret;
+    }
+#endif /* _OW_OVERDRIVE_ */
 
     OW_OUT_LOW();
     OW_DIR_OUT();             /* Pull OW-Pin low for 480us */
@@ -69,7 +134,7 @@ bool owbitbang_bus_reset(bool *presense_detect)
 
     OW_DIR_IN();
     OW_OUT_HIGH();
-    _delay_us(64);
+    _delay_us(OW_PRESENCE_SAMPLE);
     ret = !(OW_GET_IN());
 
     if (intsave)
@@ -80,7 +145,7 @@ bool owbitbang_bus_reset(bool *presense_detect)
      * and input-pin gets back to high by pull-up-resistor.
      */
     _delay_us(240);
-    _delay_us(240 - 64);     /* Was 480-66 */
+    _delay_us(240 - OW_PRESENCE_SAMPLE);
     if (OW_GET_IN() == 0)
         ret = false;          /* Short circuit, expected low but got high */
 
@@ -96,6 +161,11 @@ bool owbitbang_bus_reset(bool *presense_detect)
  * the first pulse and the calibration pulse is 60uS.
  *
  * Nothing else is needed.
+ *
+ * Only the first 15us of the slot, up to the sample, has interrupts
+ * masked. After that the line is either released already or held
+ * low for a write 0, which may run anywhere from 60 to 120us, so
+ * an ISR landing in the rest of the slot only lengthens it.
  */
 static uint8_t owbitbang_bit_xch(uint8_t b)
 {
@@ -127,6 +197,9 @@ static uint8_t owbitbang_bit_xch(uint8_t b)
         b = 0;  /* Sample at end of read-timeslot */
     }
 
+    if (intsave)
+        g_irq_enable();
+
     _delay_us(60-15-2+OW_CONF_DELAYOFFSET);
 
     /* CALIBRATION PULSE GOES HERE */
@@ -134,17 +207,57 @@ static uint8_t owbitbang_bit_xch(uint8_t b)
     OW_OUT_HIGH();
     OW_DIR_IN();
 
+    _delay_us(OW_RECOVERY_TIME); /* May be increased for longer wires */
+
+    return b;
+}
+
+#ifdef _OW_OVERDRIVE_
+
+/*
+ * The whole slot is only ~12us and the sample falls 2us after the
+ * falling edge, so interrupts stay masked throughout.
+ */
+static uint8_t owbitbang_bit_xch_od(uint8_t b)
+{
+    uint8_t intsave;
+
+    intsave = (SREG & _BV(SREG_I)) == _BV(SREG_I);
+    g_irq_disable();
+
+    OW_OUT_LOW();
+    OW_DIR_OUT();
+
+    _delay_us(1);
+    if (b)
+    {
+        OW_DIR_IN();
+        OW_OUT_HIGH();
+    }
+
+    _delay_us(OW_OD_SAMPLE);
+
+    if (OW_GET_IN() == 0)
+        b = 0;
+
+    _delay_us(OW_OD_SLOT - OW_OD_SAMPLE - 1);
+
+    OW_OUT_HIGH();
+    OW_DIR_IN();
+
+    _delay_us(OW_OD_RECOVERY_TIME);
+
     if (intsave)
         g_irq_enable();
 
-    _delay_us(OW_RECOVERY_TIME); /* May be increased for longer wires */
-
     return b;
 }
 
+#endif /* _OW_OVERDRIVE_ */
+
 bool owbitbang_bit_io(bool *bit)
 {
-    *bit = owbitbang_bit_xch(*bit);
+    *bit = OW_SLOT(*bit);
     return true;
 }
 
@@ -155,7 +268,7 @@ uint8_t owbitbang_byte_xch(uint8_t b)
 
     do
     {
-        j = owbitbang_bit_xch(b & 1);
+        j = OW_SLOT(b & 1);
         b >>= 1;
         if (j)
             b |= 0x80;
@@ -186,6 +299,8 @@ uint8_t owbitbang_rom_search(uint8_t diff, uint8_t *id)
     uint8_t next_diff;
     uint8_t b;
 
+    OW_SPEED_STD();
+
     if (!owbitbang_bus_reset(&presense) || !presense)
         return OW_PRESENCE_ERR;                /* Error: No device found. early exit. */
 
@@ -242,6 +357,8 @@ bool owbitbang_select(const uint8_t *id)
     bool presense;
     uint8_t i;
 
+    OW_SPEED_STD();
+
     if (!owbitbang_bus_reset(&presense) || !presense)
         return false;
 
@@ -263,6 +380,41 @@ bool owbitbang_select(const uint8_t *id)
     return true;
 }
 
+#ifdef _OW_OVERDRIVE_
+
+/*
+ * As owbitbang_select(), but the device(s) addressed switch to
+ * overdrive along with the master. Anything that doesn't support it
+ * just won't answer.
+ */
+bool owbitbang_select_od(const uint8_t *id)
+{
+    bool presense;
+    uint8_t i;
+
+    _g_od = false;
+
+    if (!owbitbang_bus_reset(&presense) || !presense)
+        return false;
+
+    owbitbang_byte_xch(id ? OW_OD_MATCH_ROM : OW_OD_SKIP_ROM);
+    _g_od = true;
+
+    if (id)
+    {
+        i = OW_ROMCODE_SIZE;
+        do
+        {
+            owbitbang_byte_xch(*id);
+            id++;
+        } while (--i);
+    }
+
+    return true;
+}
+
+#endif /* _OW_OVERDRIVE_ */
+
 bool owbitbang_write(const uint8_t *data, uint8_t len)
 {
     while (len--)
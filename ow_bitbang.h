@@ -31,6 +31,7 @@ bool owbitbang_bit_io(bool *bit);
 bool owbitbang_read(uint8_t *buf, uint8_t len);
 uint8_t owbitbang_rom_search(uint8_t diff, uint8_t *id);
 bool owbitbang_select(const uint8_t *id);
+bool owbitbang_select_od(const uint8_t *id);
 bool owbitbang_write(const uint8_t *data, uint8_t len);
 
 #endif /* __OW_BITBANG_H__ */
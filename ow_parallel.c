@@ -0,0 +1,292 @@
+/*
+ *   File:   ow_parallel.c
+ *   Author: Matthew Millman
+ *
+ *   Fan speed controller. OSS AVR Version.
+ *
+ *   Bit-parallel 1-Wire on several buses at once
+ *
+ *   Created on 17 October 2026, 16:40
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+
+#include "iopins.h"
+#include "config.h"
+#include "onewire.h"
+#include "crc8.h"
+#include "ow_parallel.h"
+
+#ifdef _OW_PARALLEL_
+
+/*
+ * Every bus is on the same port, so one time slot drives and samples
+ * all of them with a single register access each. With one sensor per
+ * bus, Skip ROM addresses each sensor and a whole readout takes as long
+ * as reading one sensor on its own. Slot timing is the same as
+ * ow_bitbang.c.
+ *
+ * The port is shared with F1ON and F2ON, which the PWM ramp switches
+ * from the Timer0 ISR. Every read-modify-write of OWPAR_PORT and
+ * OWPAR_DDR here is done with interrupts masked, or a ramp step landing
+ * in the middle of one would be undone.
+ */
+
+#define OWPAR_RECOVERY_TIME      20  /* usec */
+#define OWPAR_PRESENCE_SAMPLE    70  /* usec after releasing the reset pulse */
+
+static const uint8_t _g_owpar_bits[OWPAR_BUSES] =
+    {_BV(OWPAR_BUS0), _BV(OWPAR_BUS1), _BV(OWPAR_BUS2), _BV(OWPAR_BUS3)};
+
+/* Bus mask to port bits */
+static uint8_t owpar_to_port(uint8_t mask)
+{
+    uint8_t bits = 0;
+    uint8_t i;
+
+    for (i = 0; i < OWPAR_BUSES; i++)
+    {
+        if (mask & (1 << i))
+            bits |= _g_owpar_bits[i];
+    }
+
+    return bits;
+}
+
+/* Port bits to bus mask */
+static uint8_t owpar_from_port(uint8_t bits)
+{
+    uint8_t mask = 0;
+    uint8_t i;
+
+    for (i = 0; i < OWPAR_BUSES; i++)
+    {
+        if (bits & _g_owpar_bits[i])
+            mask |= (1 << i);
+    }
+
+    return mask;
+}
+
+static void owpar_low(uint8_t bits)
+{
+    uint8_t intsave;
+
+    intsave = (SREG & _BV(SREG_I)) == _BV(SREG_I);
+    g_irq_disable();
+
+    OWPAR_PORT &= ~bits;
+    OWPAR_DDR |= bits;
+
+    if (intsave)
+        g_irq_enable();
+}
+
+static void owpar_release(uint8_t bits)
+{
+    uint8_t intsave;
+
+    intsave = (SREG & _BV(SREG_I)) == _BV(SREG_I);
+    g_irq_disable();
+
+    OWPAR_DDR &= ~bits;
+    OWPAR_PORT |= bits;
+
+    if (intsave)
+        g_irq_enable();
+}
+
+void owpar_init(void)
+{
+    owpar_release(owpar_to_port((1 << OWPAR_BUSES) - 1));
+}
+
+/* *present gets the buses in mask with a device on them */
+bool owpar_bus_reset(uint8_t mask, uint8_t *present)
+{
+    uint8_t bits = owpar_to_port(mask);
+    uint8_t intsave;
+    uint8_t in;
+
+    owpar_low(bits);
+    _delay_us(240);
+    _delay_us(240);
+
+    /* Presence is only sure to be low from 60 to 75us after release */
+    intsave = (SREG & _BV(SREG_I)) == _BV(SREG_I);
+    g_irq_disable();
+
+    owpar_release(bits);
+    _delay_us(OWPAR_PRESENCE_SAMPLE);
+    in = OWPAR_PIN;
+
+    if (intsave)
+        g_irq_enable();
+
+    _delay_us(240);
+    _delay_us(240 - OWPAR_PRESENCE_SAMPLE);
+
+    /* Still low means a short */
+    *present = owpar_from_port(bits & ~in & OWPAR_PIN);
+
+    return *present != 0;
+}
+
+/*
+ * One time slot on every bus in bits. Lines in ones are released
+ * after 2us (write 1 or read), the rest are held for a write 0.
+ * Returns the port as sampled at 15us.
+ */
+static uint8_t owpar_slot(uint8_t bits, uint8_t ones)
+{
+    uint8_t intsave;
+    uint8_t in;
+
+    intsave = (SREG & _BV(SREG_I)) == _BV(SREG_I);
+    g_irq_disable();
+
+    owpar_low(bits);
+    _delay_us(2);
+    owpar_release(ones);
+    _delay_us(15-2);
+    in = OWPAR_PIN;
+
+    if (intsave)
+        g_irq_enable();
+
+    _delay_us(60-15-2);
+    owpar_release(bits);
+    _delay_us(OWPAR_RECOVERY_TIME);
+
+    return in;
+}
+
+/* Read slot. *ones gets the buses in mask that read back 1 */
+bool owpar_bit_io(uint8_t mask, uint8_t *ones)
+{
+    uint8_t bits = owpar_to_port(mask);
+
+    *ones = owpar_from_port(owpar_slot(bits, bits) & bits);
+    return true;
+}
+
+/* The same bytes to every bus in mask */
+void owpar_write(uint8_t mask, const uint8_t *data, uint8_t len)
+{
+    uint8_t bits = owpar_to_port(mask);
+    uint8_t b;
+    uint8_t i;
+
+    while (len--)
+    {
+        b = *data++;
+
+        for (i = 0; i < 8; i++)
+        {
+            owpar_slot(bits, (b & 1) ? bits : 0);
+            b >>= 1;
+        }
+    }
+}
+
+/*
+ * len bytes from every bus in mask at once. buf holds OWPAR_BUSES
+ * runs of len bytes, one per bus.
+ */
+void owpar_read(uint8_t mask, uint8_t *buf, uint8_t len)
+{
+    uint8_t bits = owpar_to_port(mask);
+    uint8_t byte;
+    uint8_t bit;
+    uint8_t in;
+    uint8_t i;
+
+    memset(buf, 0, OWPAR_BUSES * len);
+
+    for (byte = 0; byte < len; byte++)
+    {
+        for (bit = 0x01; bit; bit <<= 1)
+        {
+            in = owpar_slot(bits, bits);
+
+            for (i = 0; i < OWPAR_BUSES; i++)
+            {
+                if (in & _g_owpar_bits[i])
+                    buf[i * len + byte] |= bit;
+            }
+        }
+    }
+}
+
+/*
+ * Reset, then Skip ROM and cmd on every bus that answered. Returns
+ * the buses addressed.
+ */
+uint8_t owpar_skip(uint8_t mask, uint8_t cmd)
+{
+    uint8_t data[2];
+    uint8_t present;
+
+    if (!owpar_bus_reset(mask, &present))
+        return 0;
+
+    data[0] = OW_SKIP_ROM;
+    data[1] = cmd;
+    owpar_write(present, data, sizeof(data));
+
+    return present;
+}
+
+/*
+ * Read ROM on every bus. Only works with one device per bus, which
+ * is the point. ids are packed in bus order, up to max of them, and
+ * *mask gets the buses they came from.
+ */
+uint8_t owpar_probe(uint8_t(*ids)[OW_ROMCODE_SIZE], uint8_t max, uint8_t *mask)
+{
+    uint8_t buf[OWPAR_BUSES][OW_ROMCODE_SIZE];
+    uint8_t data = OW_READ_ROM;
+    uint8_t present;
+    uint8_t count = 0;
+    uint8_t i;
+
+    *mask = 0;
+
+    if (!owpar_bus_reset((1 << OWPAR_BUSES) - 1, &present))
+        return 0;
+
+    owpar_write(present, &data, 1);
+    owpar_read(present, buf[0], OW_ROMCODE_SIZE);
+
+    for (i = 0; i < OWPAR_BUSES && count < max; i++)
+    {
+        /* Two or more devices on a bus garble the CRC */
+        if (!(present & (1 << i)) || crc8(buf[i], OW_ROMCODE_SIZE))
+            continue;
+
+        memcpy(ids[count++], buf[i], OW_ROMCODE_SIZE);
+        *mask |= (1 << i);
+    }
+
+    return count;
+}
+
+#endif /* _OW_PARALLEL_ */
@@ -0,0 +1,39 @@
+/*
+ *   File:   ow_parallel.h
+ *   Author: Matthew Millman
+ *
+ *   Fan speed controller. OSS AVR Version.
+ *
+ *   Bit-parallel 1-Wire on several buses at once
+ *
+ *   Created on 17 October 2026, 16:40
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __OW_PARALLEL_H__
+#define __OW_PARALLEL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Masks are one bit per bus, bit 0 = OWPAR_BUS0 */
+
+void owpar_init(void);
+bool owpar_bus_reset(uint8_t mask, uint8_t *present);
+bool owpar_bit_io(uint8_t mask, uint8_t *ones);
+void owpar_write(uint8_t mask, const uint8_t *data, uint8_t len);
+void owpar_read(uint8_t mask, uint8_t *buf, uint8_t len);
+uint8_t owpar_skip(uint8_t mask, uint8_t cmd);
+uint8_t owpar_probe(uint8_t(*ids)[OW_ROMCODE_SIZE], uint8_t max, uint8_t *mask);
+
+#endif /* __OW_PARALLEL_H__ */
@@ -30,6 +30,18 @@
 // Uncomment to use DS2482 onewire bus master instead of bitbang
 //#define _OW_DS2482_
 
+// Uncomment as well if it's a DS2482-800, to use all eight channels
+//#define _OW_DS2482_800_
+
+// Uncomment to read one sensor on each of SP2, SP3, SP5 and SP6 at once, instead of a shared bus on ONEWIRE
+//#define _OW_PARALLEL_
+
+// Address overdrive capable sensors at overdrive speed. Comment out for long bus runs
+#define _OW_OVERDRIVE_
+
+// Uncomment to also use LM75, TMP102 or MCP9808 class sensors on the I2C bus (SDA/SCL)
+//#define _I2C_TEMP_
+
 #define _DS18B20_AUTHCHECK_
 
 // Common limits
@@ -49,18 +61,29 @@
 #define DEF_TEMP_MIN         180     /* Fan at minimum (18 degrees) */
 #define DEF_TEMP_MAX         300     /* Fan 100% on (30 degrees) */
 #define DEF_MIN_RPM          0       /* Minimum fan speed before restore kicks in */
+#define DEF_MAX_RPM          0       /* Fan speed at 100%. 0 = duty cycle control */
+#define DEF_SENSOR_RES       12      /* DS18B20 resolution in bits */
+#define DEF_TEMP_SETPOINT    240     /* PID target (24 degrees) */
+#define DEF_PID_KP           100     /* 10.0% duty per degree */
+#define DEF_PID_KI           5       /* 0.5% duty per degree, per second */
+#define DEF_PID_KD           0
+
+#define CURVE_MAX_POINTS     8       /* Per zone */
+#define DEF_FAN_RAMP         0       /* % per second. 0 = duty changes apply immediately */
 
-#define UART_BAUD            9600   // 38400 is the maximum accurate baud for the 12.288MHz crystal installed
+#define UART_BAUD            9600   // Startup and config prompt. Use the 'baud' setting for more
 
 // Constants (which shouldn't be changed)
 
+/* Bump the high byte whenever the layout of sys_config_t changes */
 #ifdef _SINGLEZONE_
-#define CONFIG_MAGIC         0x4644
+#define CONFIG_MAGIC         0x4E44
 #else
-#define CONFIG_MAGIC         0x4643
+#define CONFIG_MAGIC         0x4E43
 #endif
 
 #define PWM_BASE             512
+#define PWM_BITS             9       /* log2(PWM_BASE) */
 
 #define FAN1                 0
 #define FAN2                 1
@@ -81,16 +104,35 @@
 #define _I2C_XFER_
 #define _I2C_XFER_BYTE_
 #define _I2C_DS2482_SPECIAL_
+#define _I2C_BRUTEFORCE_RESET_       // Clock out a slave holding SDA low on timeout and at startup
+#define _I2C_ASYNC_                  // TWI transactions are queued and clocked from the TWI ISR
+//#define _I2C_XFER_RS_              // Polled driver instead. Needed for _I2C_DS2482_SPECIAL_ without _I2C_ASYNC_
+#ifndef _OW_DS2482_800_
+#define _OW_ASYNC_                   // Periodic sensor reads run in the background through the TWI queue
+#endif /* _OW_DS2482_800_ */
 #else
 #define _OW_BITBANG_
+#ifndef _OW_PARALLEL_
+#define _OW_ASYNC_                   // Periodic sensor reads run from the Timer2 compare ISR
+#endif /* _OW_PARALLEL_ */
 #endif /* _OW_DS2482_ */
+#ifdef _I2C_TEMP_
+#define _I2C_
+#define _I2C_XFER_X16_
+#define _I2C_BRUTEFORCE_RESET_
+#endif /* _I2C_TEMP_ */
 
 // Function redefinitions
 
 #define console_busy         usart1_busy
 #define console_put          usart1_put
+#define console_put_nowait   usart1_put_nowait
+#define console_tx_dropped   usart1_tx_dropped
+#define console_tx_free      usart1_tx_free
 #define console_data_ready   usart1_data_ready
 #define console_get          usart1_get
+#define console_set_rx_gap   usart1_set_rx_gap
+#define console_rx_gap       usart1_rx_gap
 
 #define g_irq_disable cli
 #define g_irq_enable sei
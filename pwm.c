@@ -19,17 +19,26 @@
  *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#ifndef __PWM_H__
-#define __PWM_H__
-
 #include "project.h"
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
 
 #include "iopins.h"
+#include "sched.h"
 #include "pwm.h"
 
+#define PWM_CHANNELS         2
+#define PWM_RAMP_FRAC        6       /* Ramp position is held in 1/64 count */
+
+static volatile uint16_t _g_ramp_step;   /* Per tick. 0 = changes apply immediately */
+static volatile uint16_t _g_ramp_target[PWM_CHANNELS];
+static volatile uint16_t _g_ramp_pos[PWM_CHANNELS];
+
+static void pwm_apply(uint8_t pwm, uint16_t duty);
+
 void pwm_init(void)
 {
     // 9-bit, precaler = 1, non inverting.
@@ -40,12 +49,8 @@ void pwm_init(void)
     IO_OUTPUT(F2PWM);
 }
 
-void pwm_setduty(uint8_t pwm, uint8_t pct)
+static void pwm_apply(uint8_t pwm, uint16_t duty)
 {
-    uint16_t duty;
-
-    duty = ((uint32_t)pct * PWM_BASE) / 100;
-
     // Kludge 1: 0x0000 is not 0%. Have to disable PWM
     if (duty == 0x0000)
     {
@@ -81,4 +86,85 @@ void pwm_setduty(uint8_t pwm, uint8_t pct)
     }
 }
 
-#endif /* __PWM_H__ */
+/*
+ * Slew limit in percent per second. Takes effect from the next
+ * change of duty.
+ */
+void pwm_set_ramp(uint8_t pct_per_sec)
+{
+    uint32_t step = ((uint32_t)pwm_pct_to_counts(pct_per_sec) << PWM_RAMP_FRAC) * SCHED_TICK_MS / 1000;
+    uint8_t intsave;
+
+    if (pct_per_sec && !step)
+        step = 1;
+
+    /* Can change at runtime. The ISR mustn't see half of it */
+    intsave = (SREG & _BV(SREG_I)) == _BV(SREG_I);
+    g_irq_disable();
+
+    _g_ramp_step = step;
+
+    if (intsave)
+        g_irq_enable();
+}
+
+void pwm_setduty(uint8_t pwm, uint16_t duty)
+{
+    uint8_t intsave;
+
+    intsave = (SREG & _BV(SREG_I)) == _BV(SREG_I);
+    g_irq_disable();
+
+    _g_ramp_target[pwm] = duty;
+
+    if (!_g_ramp_step)
+    {
+        _g_ramp_pos[pwm] = duty << PWM_RAMP_FRAC;
+        pwm_apply(pwm, duty);
+    }
+
+    if (intsave)
+        g_irq_enable();
+}
+
+/* Skips the ramp. For stall recovery, which needs max at once */
+void pwm_setduty_now(uint8_t pwm, uint16_t duty)
+{
+    uint8_t intsave;
+
+    intsave = (SREG & _BV(SREG_I)) == _BV(SREG_I);
+    g_irq_disable();
+
+    _g_ramp_target[pwm] = duty;
+    _g_ramp_pos[pwm] = duty << PWM_RAMP_FRAC;
+    pwm_apply(pwm, duty);
+
+    if (intsave)
+        g_irq_enable();
+}
+
+/* Called from the Timer0 overflow ISR. Moves each output one step towards its target */
+void pwm_ramp_tick(void)
+{
+    uint8_t i;
+
+    if (!_g_ramp_step)
+        return;
+
+    for (i = 0; i < PWM_CHANNELS; i++)
+    {
+        uint16_t target = _g_ramp_target[i] << PWM_RAMP_FRAC;
+        uint16_t pos = _g_ramp_pos[i];
+
+        if (pos == target)
+            continue;
+
+        if (pos < target)
+            pos = (target - pos > _g_ramp_step) ? pos + _g_ramp_step : target;
+        else
+            pos = (pos - target > _g_ramp_step) ? pos - _g_ramp_step : target;
+
+        _g_ramp_pos[i] = pos;
+        pwm_apply(i, (pos + (1 << (PWM_RAMP_FRAC - 1))) >> PWM_RAMP_FRAC);
+    }
+}
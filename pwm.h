@@ -22,8 +22,18 @@
 #ifndef __PWM_H__
 #define	__PWM_H__
 
+/*
+ * Conversions between percent and PWM counts without a runtime divide.
+ * 1311 / 256 is PWM_BASE / 100 rounded up, so 100% still gives PWM_BASE.
+ */
+#define pwm_pct_to_counts(pct) ((uint16_t)(((uint32_t)(pct) * ((PWM_BASE * 256UL + 99) / 100)) >> 8))
+#define pwm_counts_to_pct(cnt) ((uint8_t)((((uint32_t)(cnt) * 100) + (PWM_BASE / 2)) >> PWM_BITS))
+
 void pwm_init(void);
-void pwm_setduty(uint8_t pwm, uint8_t pct);
+void pwm_setduty(uint8_t pwm, uint16_t duty);
+void pwm_setduty_now(uint8_t pwm, uint16_t duty);
+void pwm_set_ramp(uint8_t pct_per_sec);
+void pwm_ramp_tick(void);
 
 #endif	/* __PWM_H__ */
 
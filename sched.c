@@ -0,0 +1,178 @@
+/*
+ *   File:   sched.c
+ *   Author: Matthew Millman
+ *
+ *   Fan speed controller. OSS AVR Version.
+ *
+ *   Cooperative tick driven task scheduler
+ *
+ *   Created on 17 October 2026, 09:40
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include "sched.h"
+#include "util.h"
+
+/* Timer0 counts per tick. One count is 1024 CPU cycles (83.3us) */
+#define SCHED_COUNTS_PER_TICK (256 - TIMER0VAL)
+
+typedef struct {
+    sched_fn_t fn;
+    uint16_t interval;   /* Ticks between runs. 0 = run once when woken */
+    uint16_t due;        /* Tick at which the task next runs */
+    uint16_t max_time;   /* Longest observed run time in Timer0 counts */
+    bool active;
+} sched_task_t;
+
+volatile uint16_t _g_sched_ticks;
+static sched_task_t _g_tasks[SCHED_MAX_TASKS];
+
+/*
+ * Timer0 counts since the scheduler started. Finer grained than
+ * the tick so short running tasks can be measured.
+ */
+static uint16_t sched_stamp(void)
+{
+    uint16_t ticks;
+    uint8_t count;
+    uint8_t intsave;
+
+    intsave = (SREG & _BV(SREG_I)) == _BV(SREG_I);
+    g_irq_disable();
+
+    ticks = _g_sched_ticks;
+    count = TCNT0;
+
+    /* Overflowed but the ISR hasn't reloaded the counter yet */
+    if ((TIFR0 & _BV(TOV0)) && count < TIMER0VAL)
+        ticks++;
+    else
+        count -= TIMER0VAL;
+
+    if (intsave)
+        g_irq_enable();
+
+    return (ticks * SCHED_COUNTS_PER_TICK) + count;
+}
+
+void sched_init(void)
+{
+    uint8_t i;
+
+    _g_sched_ticks = 0;
+
+    for (i = 0; i < SCHED_MAX_TASKS; i++)
+        _g_tasks[i].active = false;
+}
+
+void sched_add(uint8_t task, sched_fn_t fn, uint16_t interval, uint16_t delay)
+{
+    sched_task_t *t = &_g_tasks[task];
+
+    t->fn = fn;
+    t->interval = interval;
+    t->max_time = 0;
+    t->due = sched_now() + delay;
+    t->active = (delay != SCHED_SUSPENDED);
+}
+
+void sched_wake(uint8_t task, uint16_t delay)
+{
+    sched_task_t *t = &_g_tasks[task];
+
+    t->due = sched_now() + delay;
+    t->active = true;
+}
+
+void sched_suspend(uint8_t task)
+{
+    _g_tasks[task].active = false;
+}
+
+uint16_t sched_now(void)
+{
+    uint16_t ticks;
+    uint8_t intsave;
+
+    intsave = (SREG & _BV(SREG_I)) == _BV(SREG_I);
+    g_irq_disable();
+
+    ticks = _g_sched_ticks;
+
+    if (intsave)
+        g_irq_enable();
+
+    return ticks;
+}
+
+void sched_run(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < SCHED_MAX_TASKS; i++)
+    {
+        sched_task_t *t = &_g_tasks[i];
+        uint16_t now = sched_now();
+        uint16_t start;
+        uint16_t elapsed;
+
+        if (!t->active || (int16_t)(now - t->due) < 0)
+            continue;
+
+        /* Re-arm before running so the task is free to reschedule itself */
+        if (t->interval)
+        {
+            t->due += t->interval;
+
+            /* Don't try to catch up on missed runs */
+            if ((int16_t)(now - t->due) >= 0)
+                t->due = now + t->interval;
+        }
+        else
+        {
+            t->active = false;
+        }
+
+        start = sched_stamp();
+        t->fn();
+        elapsed = sched_stamp() - start;
+
+        if (elapsed > t->max_time)
+            t->max_time = elapsed;
+    }
+}
+
+void sched_print_stats(void)
+{
+    uint8_t i;
+
+    printf("\r\n");
+
+    for (i = 0; i < SCHED_MAX_TASKS; i++)
+    {
+        if (!_g_tasks[i].fn)
+            continue;
+
+        printf("Task %u max run time ..........: %lu us\r\n", i,
+            ((uint32_t)_g_tasks[i].max_time * 1000UL) / (F_CPU / 1024000UL));
+    }
+}
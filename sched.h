@@ -0,0 +1,50 @@
+/*
+ *   File:   sched.h
+ *   Author: Matthew Millman
+ *
+ *   Fan speed controller. OSS AVR Version.
+ *
+ *   Cooperative tick driven task scheduler
+ *
+ *   Created on 17 October 2026, 09:40
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCHED_MAX_TASKS      8
+#define SCHED_TICK_MS        10      /* Timer0 overflow period */
+#define SCHED_SUSPENDED      0xFFFF  /* sched_add() delay: don't run until woken */
+
+#define sched_ms_to_ticks(ms) (((ms) + SCHED_TICK_MS - 1) / SCHED_TICK_MS)
+
+typedef void (*sched_fn_t)(void);
+
+extern volatile uint16_t _g_sched_ticks;
+
+/* Called from the Timer0 overflow ISR */
+#define sched_tick() _g_sched_ticks++
+
+void sched_init(void);
+void sched_add(uint8_t task, sched_fn_t fn, uint16_t interval, uint16_t delay);
+void sched_wake(uint8_t task, uint16_t delay);
+void sched_suspend(uint8_t task);
+uint16_t sched_now(void);
+void sched_run(void);
+void sched_print_stats(void);
+
+#endif /* __SCHED_H__ */
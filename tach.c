@@ -0,0 +1,144 @@
+/*
+ *   File:   tach.c
+ *   Author: Matthew Millman
+ *
+ *   Fan speed controller. OSS AVR Version.
+ *
+ *   Tachometer period measurement
+ *
+ *   Created on 17 October 2026, 13:05
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "iopins.h"
+#include "timer.h"
+#include "tach.h"
+
+/*
+ * Each rising edge on a tach input is timestamped against Timer2.
+ * The time taken for a whole revolution is latched every
+ * TACH_PULSES_PER_REV edges, which cancels out any asymmetry
+ * between the poles of the fan's sense magnet.
+ */
+
+#define TACH_RPM_CONST       ((uint32_t)TIMER2_HZ * 60)
+#define TACH_MIN_PULSE       ((uint32_t)TIMER2_HZ * 60 / TACH_MAX_RPM / TACH_PULSES_PER_REV)
+#define TACH_TIMEOUT         ((uint32_t)TIMER2_HZ / 1000 * TACH_TIMEOUT_MS)
+
+typedef struct {
+    uint32_t last_edge;
+    uint32_t rev_start;
+    uint32_t rev_period;
+    uint8_t pulses;
+    bool idle;           /* Next edge starts a new measurement */
+    bool fresh;          /* rev_period not yet converted to RPM */
+} tach_t;
+
+static volatile tach_t _g_tach[MAX_FANS];
+static uint8_t _g_last_portc;
+
+static void tach_edge(volatile tach_t *t, uint32_t stamp)
+{
+    if (t->idle)
+    {
+        t->idle = false;
+        t->pulses = 0;
+        t->rev_start = stamp;
+        t->last_edge = stamp;
+        return;
+    }
+
+    if (((stamp - t->last_edge) & TIMER2_STAMP_MASK) < TACH_MIN_PULSE)
+        return;
+
+    t->last_edge = stamp;
+
+    if (++t->pulses < TACH_PULSES_PER_REV)
+        return;
+
+    t->pulses = 0;
+    t->rev_period = (stamp - t->rev_start) & TIMER2_STAMP_MASK;
+    t->rev_start = stamp;
+    t->fresh = true;
+}
+
+ISR(PCINT1_vect)
+{
+    uint8_t portc = F1TACH_PIN;
+    uint8_t rising = portc & ~_g_last_portc;
+    uint32_t stamp;
+
+    _g_last_portc = portc;
+
+    if (!(rising & (_BV(F1TACH) | _BV(F2TACH))))
+        return;
+
+    stamp = timer2_stamp();
+
+    if (rising & _BV(F1TACH))
+        tach_edge(&_g_tach[0], stamp);
+
+    if (rising & _BV(F2TACH))
+        tach_edge(&_g_tach[1], stamp);
+}
+
+void tach_init(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < MAX_FANS; i++)
+    {
+        _g_tach[i].idle = true;
+        _g_tach[i].fresh = false;
+    }
+
+    _g_last_portc = F1TACH_PIN;
+
+    PCICR |= _BV(PCIE1);
+    PCMSK1 |= _BV(PCINT10);
+    PCMSK1 |= _BV(PCINT11);
+}
+
+/* Converts any newly completed revolutions to RPM. Call often */
+void tach_update(uint16_t *rpm)
+{
+    uint8_t i;
+
+    for (i = 0; i < MAX_FANS; i++)
+    {
+        volatile tach_t *t = &_g_tach[i];
+        uint32_t period = 0;
+        bool fresh;
+
+        g_irq_disable();
+        fresh = t->fresh;
+        t->fresh = false;
+        if (fresh)
+            period = t->rev_period;
+        if (!t->idle && ((timer2_stamp() - t->last_edge) & TIMER2_STAMP_MASK) > TACH_TIMEOUT)
+            t->idle = true;
+        g_irq_enable();
+
+        if (t->idle)
+            rpm[i] = 0;
+        else if (fresh && period)
+            rpm[i] = TACH_RPM_CONST / period;
+    }
+}
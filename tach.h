@@ -0,0 +1,35 @@
+/*
+ *   File:   tach.h
+ *   Author: Matthew Millman
+ *
+ *   Fan speed controller. OSS AVR Version.
+ *
+ *   Tachometer period measurement
+ *
+ *   Created on 17 October 2026, 13:05
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TACH_H__
+#define __TACH_H__
+
+#include <stdint.h>
+
+#define TACH_PULSES_PER_REV  2       /* Standard PC fan tach output */
+#define TACH_MAX_RPM         20000   /* Edges faster than this are treated as noise */
+#define TACH_TIMEOUT_MS      1000    /* No edges for this long reads as 0 RPM */
+
+void tach_init(void);
+void tach_update(uint16_t *rpm);
+
+#endif /* __TACH_H__ */
@@ -0,0 +1,99 @@
+/*
+ *   File:   telemetry.c
+ *   Author: Matthew Millman
+ *
+ *   Fan speed controller. OSS AVR Version.
+ *
+ *   Binary status frames on the console
+ *
+ *   Created on 17 October 2026, 19:05
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "project.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "usart.h"
+#include "crc8.h"
+#include "telemetry.h"
+
+/*
+ * A frame is the payload and its CRC-8, COBS encoded so it has no zero
+ * bytes, with a zero either side. Anything printed as text in between
+ * frames (stall warnings and the like) ends up as a "frame" of its own
+ * that fails the CRC, so the decoder can pass it through as text.
+ *
+ * A frame that doesn't fit in the TX buffer is dropped whole rather
+ * than waited for, so the host never sees half of one.
+ */
+
+#define TELEMETRY_DELIM      0x00
+
+/* Payload, CRC and one COBS code byte. Payloads are well under 254 bytes */
+#define TELEMETRY_MAX_FRAME  (TELEMETRY_MAX_PAYLOAD + 2)
+
+static uint16_t _g_telemetry_dropped;
+
+void telemetry_send(uint8_t *payload, uint8_t len)
+{
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    uint8_t crc = crc8(payload, len);
+    uint8_t code_idx = 0;
+    uint8_t out = 1;
+    uint8_t b;
+    uint8_t i;
+
+    if (len > TELEMETRY_MAX_PAYLOAD)
+        return;
+
+    /* The CRC goes through the encoder as the byte after the payload */
+    for (i = 0; i <= len; i++)
+    {
+        b = (i < len) ? payload[i] : crc;
+
+        if (b == 0)
+        {
+            frame[code_idx] = out - code_idx;
+            code_idx = out++;
+        }
+        else
+        {
+            frame[out++] = b;
+        }
+    }
+
+    frame[code_idx] = out - code_idx;
+
+    /* Frame and both delimiters */
+    if (console_tx_free() < out + 2)
+    {
+        if (_g_telemetry_dropped != 0xFFFF)
+            _g_telemetry_dropped++;
+
+        return;
+    }
+
+    console_put_nowait(TELEMETRY_DELIM);
+
+    for (i = 0; i < out; i++)
+        console_put_nowait(frame[i]);
+
+    console_put_nowait(TELEMETRY_DELIM);
+}
+
+uint16_t telemetry_dropped(void)
+{
+    return _g_telemetry_dropped;
+}
@@ -0,0 +1,51 @@
+/*
+ *   File:   telemetry.h
+ *   Author: Matthew Millman
+ *
+ *   Fan speed controller. OSS AVR Version.
+ *
+ *   Binary status frames on the console
+ *
+ *   Created on 17 October 2026, 19:05
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TELEMETRY_STATUS     0x01    /* Frame type */
+
+/*
+ * Sent as is, little endian, which is what tools/telemetry.py expects.
+ * Change the frame type if this changes.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t seq;
+    uint8_t slots;                  /* MAX_SENSORS << 4 | MAX_FANS */
+    uint8_t num_sensors;
+    uint8_t sensor_state;           /* Bit per sensor. Set if temp is valid */
+    int16_t temp[MAX_SENSORS];      /* 0.1 degree */
+    uint16_t rpm[MAX_FANS];
+    uint16_t duty[MAX_FANS];        /* PWM counts, out of PWM_BASE */
+} telemetry_status_t;
+
+#define TELEMETRY_MAX_PAYLOAD sizeof(telemetry_status_t)
+
+void telemetry_send(uint8_t *payload, uint8_t len);
+uint16_t telemetry_dropped(void);
+
+#endif /* __TELEMETRY_H__ */
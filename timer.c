@@ -20,9 +20,17 @@
 
 #include <stdint.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
 
 #include "timer.h"
 
+static volatile uint16_t _g_timer2_ovf;
+
+ISR(TIMER2_OVF_vect)
+{
+    _g_timer2_ovf++;
+}
+
 void timer0_init(void)
 {
     TCCR0A = 0x00;
@@ -46,4 +54,39 @@ void timer0_stop()
 void timer0_reload(uint8_t val)
 {
     TCNT0 = val;
-}
\ No newline at end of file
+}
+
+/* Free running time base. Clk/32 = 384KHz, overflows at 1.5KHz */
+void timer2_init(void)
+{
+    _g_timer2_ovf = 0;
+
+    TCCR2A = 0x00;
+    TCCR2B = _BV(CS21) | _BV(CS20);
+    TCNT2 = 0;
+    TIFR2 = _BV(TOV2);
+    TIMSK2 |= _BV(TOIE2);
+}
+
+/* 24 bit timestamp in Timer2 counts. Safe to call from an ISR */
+uint32_t timer2_stamp(void)
+{
+    uint16_t ovf;
+    uint8_t count;
+    uint8_t intsave;
+
+    intsave = (SREG & _BV(SREG_I)) == _BV(SREG_I);
+    g_irq_disable();
+
+    ovf = _g_timer2_ovf;
+    count = TCNT2;
+
+    /* Wrapped but the overflow hasn't been serviced yet */
+    if ((TIFR2 & _BV(TOV2)) && count < 0x80)
+        ovf++;
+
+    if (intsave)
+        g_irq_enable();
+
+    return ((uint32_t)ovf << 8) | count;
+}
@@ -19,6 +19,10 @@
 #ifndef __TIMER_H__
 #define __TIMER_H__
 
+#define TIMER2_PRESCALER     32
+#define TIMER2_HZ            (F_CPU / TIMER2_PRESCALER)
+#define TIMER2_STAMP_MASK    0x00FFFFFFUL    /* 16 bit overflow count + TCNT2 */
+
 void timer1_init(void);
 void timer1_start(void);
 void timer1_stop(void);
@@ -29,4 +33,7 @@ void timer0_start(void);
 void timer0_stop(void);
 void timer0_reload(uint8_t val);
 
+void timer2_init(void);
+uint32_t timer2_stamp(void);
+
 #endif /* __TIMER_H__ */
\ No newline at end of file
@@ -0,0 +1,232 @@
+/*
+ *   File:   slave.c
+ *   Author: Matthew Millman
+ *
+ *   Fan speed controller. OSS AVR Version.
+ *
+ *   modbus.c built for the host, with the console UART on a pty
+ *
+ *   Created on 17 October 2026, 21:30
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: slave <address>
+ *
+ * Prints the pty to talk to on the first line of stdout, then runs
+ * modbus_poll() every 10ms like task_console() does. The pty is the
+ * RS-485 line, at 9600 baud as far as frame gaps go. Between ticks
+ * bytes are read as they arrive and timed like the RX interrupt does.
+ * "RESET" is printed when the firmware would reset.
+ *
+ * Registers, so the test knows what to expect:
+ *
+ *   Input 0 to 3         1000 + register
+ *   Holding 0 to 15      Plain storage, 0 at start
+ *   Holding 0x0100       Command. 1 is OK, 2 is OK then reset
+ *   Anything else        Illegal data address
+ */
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "project.h"
+#include "sched.h"
+#include "timer.h"
+#include "modbus.h"
+
+#define SLAVE_BAUD           9600
+#define SLAVE_INPUT_REGS     4
+#define SLAVE_HOLDING_REGS   16
+#define SLAVE_RX_SIZE        256
+
+static int _g_fd;
+static uint8_t _g_rx[SLAVE_RX_SIZE];
+static bool _g_rx_gap[SLAVE_RX_SIZE];
+static uint8_t _g_rx_head;
+static uint8_t _g_rx_tail;
+static uint64_t _g_rx_stamp;        /* ns */
+static uint64_t _g_rx_gap_ns;
+static uint16_t _g_holding[SLAVE_HOLDING_REGS];
+
+static uint64_t slave_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* What the RX interrupt does, for everything waiting on the pty */
+static void slave_rx(void)
+{
+    uint64_t now = slave_now();
+    uint8_t c;
+
+    while (read(_g_fd, &c, 1) == 1)
+    {
+        if ((uint8_t)(_g_rx_head + 1) == _g_rx_tail)
+            continue;
+
+        _g_rx_head++;
+        _g_rx[_g_rx_head] = c;
+        _g_rx_gap[_g_rx_head] = _g_rx_gap_ns && now - _g_rx_stamp >= _g_rx_gap_ns;
+        _g_rx_stamp = now;
+    }
+}
+
+/* The parts of usart_buffered.c that modbus.c uses */
+
+bool usart1_data_ready(void)
+{
+    return _g_rx_head != _g_rx_tail;
+}
+
+char usart1_get(void)
+{
+    if (_g_rx_head == _g_rx_tail)
+        return 0x00;
+
+    return _g_rx[++_g_rx_tail];
+}
+
+void usart1_set_rx_gap(uint16_t counts)
+{
+    _g_rx_gap_ns = (uint64_t)counts * 1000000000 / TIMER2_HZ;
+}
+
+bool usart1_rx_gap(void)
+{
+    if (_g_rx_head != _g_rx_tail)
+        return _g_rx_gap[(uint8_t)(_g_rx_tail + 1)];
+
+    return slave_now() - _g_rx_stamp >= _g_rx_gap_ns;
+}
+
+void usart1_put(char c)
+{
+    while (write(_g_fd, &c, 1) != 1)
+        usleep(100);
+}
+
+bool usart1_busy(void)
+{
+    return false;
+}
+
+void reset(void)
+{
+    printf("RESET\n");
+    fflush(stdout);
+}
+
+uint8_t modbus_read_input(uint16_t reg, uint16_t *val)
+{
+    if (reg >= SLAVE_INPUT_REGS)
+        return MODBUS_EX_ADDRESS;
+
+    *val = 1000 + reg;
+    return MODBUS_OK;
+}
+
+uint8_t modbus_read_holding(uint16_t reg, uint16_t *val)
+{
+    if (reg >= SLAVE_HOLDING_REGS)
+        return MODBUS_EX_ADDRESS;
+
+    *val = _g_holding[reg];
+    return MODBUS_OK;
+}
+
+uint8_t modbus_write_holding(uint16_t reg, uint16_t val)
+{
+    if (reg == MODBUS_HR_COMMAND)
+    {
+        if (val == MODBUS_CMD_SAVE)
+            return MODBUS_OK;
+
+        if (val == MODBUS_CMD_RESTART)
+            return MODBUS_RESET;
+
+        return MODBUS_EX_VALUE;
+    }
+
+    if (reg >= SLAVE_HOLDING_REGS)
+        return MODBUS_EX_ADDRESS;
+
+    _g_holding[reg] = val;
+    return MODBUS_OK;
+}
+
+int main(int argc, char **argv)
+{
+    struct termios tio;
+    struct pollfd pfd;
+    uint64_t tick;
+    uint64_t now;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <address>\n", argv[0]);
+        return 1;
+    }
+
+    _g_fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (_g_fd < 0 || grantpt(_g_fd) || unlockpt(_g_fd))
+    {
+        perror("pty");
+        return 1;
+    }
+
+    tcgetattr(_g_fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(_g_fd, TCSANOW, &tio);
+    fcntl(_g_fd, F_SETFL, O_NONBLOCK);
+
+    printf("%s\n", ptsname(_g_fd));
+    fflush(stdout);
+
+    modbus_init(atoi(argv[1]), SLAVE_BAUD);
+
+    pfd.fd = _g_fd;
+    pfd.events = POLLIN;
+    tick = slave_now();
+
+    for (;;)
+    {
+        tick += SCHED_TICK_MS * 1000000;
+
+        while ((now = slave_now()) < tick)
+        {
+            /* Nothing else to wait on until the master opens the pty */
+            if (poll(&pfd, 1, (tick - now + 999999) / 1000000) > 0 && !(pfd.revents & POLLIN))
+                usleep((tick - now) / 1000);
+            else
+                slave_rx();
+        }
+
+        modbus_poll();
+    }
+}
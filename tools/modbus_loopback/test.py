@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+#
+#   File:   test.py
+#   Author: Matthew Millman
+#
+#   Fan speed controller. OSS AVR Version.
+#
+#   Loopback test for modbus.c, with a pty standing in for the RS-485 line
+#
+#   Created on 17 October 2026, 21:30
+#
+#   This is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 2 of the License, or
+#   (at your option) any later version.
+#   This software is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#   You should have received a copy of the GNU General Public License
+#   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+#
+# Usage: tools/modbus_loopback/test.py [-cc gcc]
+#
+# Builds modbus.c from the top of the tree with slave.c (host gcc, no
+# AVR toolchain needed), acts as the master on the pty it opens, and
+# checks every reply byte for byte. Exits non-zero if anything fails.
+
+import argparse
+import os
+import select
+import subprocess
+import sys
+import tempfile
+import time
+import tty
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+TOP = os.path.dirname(os.path.dirname(HERE))
+
+SLAVE_ADDR = 5
+IDLE = 0.1          # Seconds of quiet that end a reply. modbus.c takes up to 15ms
+GAP = 0.008         # Between back-to-back frames. 3.5 characters at 9600 baud is 3.6ms
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def frame(*body):
+    data = bytes(body)
+    crc = crc16(data)
+    return data + bytes([crc & 0xFF, crc >> 8])
+
+
+def u16(*vals):
+    out = []
+    for v in vals:
+        out += [v >> 8, v & 0xFF]
+    return out
+
+
+class Line:
+    def __init__(self, path):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(self.fd)
+
+    def transact(self, data, before=()):
+        # Other traffic on the bus first, each frame followed by a gap
+        for f in before:
+            os.write(self.fd, f)
+            time.sleep(GAP)
+        os.write(self.fd, data)
+        reply = b''
+        while True:
+            r, _, _ = select.select([self.fd], [], [], IDLE)
+            if not r:
+                return reply
+            reply += os.read(self.fd, 256)
+
+
+def build(cc, out):
+    subprocess.check_call([cc, '-std=gnu11', '-Wall', '-Werror', '-Wno-unused-function',
+                           '-I', HERE, '-I', TOP, '-o', out,
+                           os.path.join(HERE, 'slave.c'), os.path.join(TOP, 'modbus.c')])
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__)
+    ap.add_argument('-cc', default='gcc', help='host C compiler')
+    args = ap.parse_args()
+
+    a = SLAVE_ADDR
+    tests = [
+        # Name, request, expected reply (None for silence), frames sent just before it
+        ('read input',
+         frame(a, 0x04, *u16(0, 3)), frame(a, 0x04, 6, *u16(1000, 1001, 1002))),
+        ('read holding, initial',
+         frame(a, 0x03, *u16(2, 1)), frame(a, 0x03, 2, *u16(0))),
+        ('write single',
+         frame(a, 0x06, *u16(2, 0x1234)), frame(a, 0x06, *u16(2, 0x1234))),
+        ('read back single',
+         frame(a, 0x03, *u16(2, 1)), frame(a, 0x03, 2, *u16(0x1234))),
+        ('write multiple',
+         frame(a, 0x10, *u16(4, 3), 6, *u16(7, 8, 9)), frame(a, 0x10, *u16(4, 3))),
+        ('read back multiple',
+         frame(a, 0x03, *u16(4, 3)), frame(a, 0x03, 6, *u16(7, 8, 9))),
+        ('broadcast write',
+         frame(0, 0x06, *u16(10, 0xBEEF)), None),
+        ('read back broadcast',
+         frame(a, 0x03, *u16(10, 1)), frame(a, 0x03, 2, *u16(0xBEEF))),
+        ('other slave',
+         frame(a + 1, 0x03, *u16(0, 1)), None),
+        ('bad CRC',
+         frame(a, 0x03, *u16(0, 1))[:-1] + b'\x00', None),
+        ('bad function',
+         frame(a, 0x07), frame(a, 0x87, 0x01)),
+        ('bad input address',
+         frame(a, 0x04, *u16(3, 2)), frame(a, 0x84, 0x02)),
+        ('bad holding address',
+         frame(a, 0x06, *u16(16, 1)), frame(a, 0x86, 0x02)),
+        ('zero count',
+         frame(a, 0x03, *u16(0, 0)), frame(a, 0x83, 0x03)),
+        ('too many registers',
+         frame(a, 0x03, *u16(0, 17)), frame(a, 0x83, 0x03)),
+        ('byte count mismatch',
+         frame(a, 0x10, *u16(0, 2), 2, *u16(1, 2)), frame(a, 0x90, 0x03)),
+        ('bad command',
+         frame(a, 0x06, *u16(0x0100, 3)), frame(a, 0x86, 0x03)),
+        ('save',
+         frame(a, 0x06, *u16(0x0100, 1)), frame(a, 0x06, *u16(0x0100, 1))),
+        ('after other slave',
+         frame(a, 0x04, *u16(1, 1)), frame(a, 0x04, 2, *u16(1001)),
+         (frame(a + 1, 0x03, *u16(0, 2)), frame(a + 1, 0x03, 4, *u16(0x1111, 0x2222)))),
+    ]
+
+    failed = 0
+
+    with tempfile.TemporaryDirectory() as tmp:
+        exe = os.path.join(tmp, 'slave')
+        build(args.cc, exe)
+
+        slave = subprocess.Popen([exe, str(a)], stdout=subprocess.PIPE, text=True)
+        try:
+            line = Line(slave.stdout.readline().strip())
+
+            for name, req, want, *before in tests:
+                got = line.transact(req, *before)
+                ok = got == (want or b'')
+                failed += not ok
+                print('%-24s %s' % (name, 'ok' if ok else 'FAIL: sent %s, wanted %s, got %s' %
+                                    (req.hex(' '), want.hex(' ') if want else 'nothing', got.hex(' ') or 'nothing')))
+
+            # Restart replies first, then resets
+            want = frame(a, 0x06, *u16(0x0100, 2))
+            got = line.transact(want)
+            reset = slave.stdout.readline().strip() == 'RESET'
+            ok = got == want and reset
+            failed += not ok
+            print('%-24s %s' % ('restart', 'ok' if ok else 'FAIL: got %s, reset %s' % (got.hex(' '), reset)))
+        finally:
+            slave.kill()
+            slave.wait()
+
+    print('%u of %u failed' % (failed, len(tests) + 1) if failed else 'All passed')
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,41 @@
+/*
+ *   File:   crc16.h
+ *   Author: Matthew Millman
+ *
+ *   Fan speed controller. OSS AVR Version.
+ *
+ *   Host stand-in for avr-libc's util/crc16.h, for the Modbus loopback test
+ *
+ *   Created on 17 October 2026, 21:30
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UTIL_CRC16_H__
+#define __UTIL_CRC16_H__
+
+#include <stdint.h>
+
+/* Same polynomial (0xA001, reflected 0x8005) as the avr-libc version */
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t a)
+{
+    uint8_t i;
+
+    crc ^= a;
+
+    for (i = 0; i < 8; i++)
+        crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+
+    return crc;
+}
+
+#endif /* __UTIL_CRC16_H__ */
@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+#
+#   File:   telemetry.py
+#   Author: Matthew Millman
+#
+#   Fan speed controller. OSS AVR Version.
+#
+#   Decodes the binary status frames sent with 'telemetry 1' set
+#
+#   Created on 17 October 2026, 19:05
+#
+#   This is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 2 of the License, or
+#   (at your option) any later version.
+#   This software is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#   You should have received a copy of the GNU General Public License
+#   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+#
+# Usage: telemetry.py [-b baud] [--csv] /dev/ttyUSB0
+#
+# Frames are COBS encoded, payload then Dallas/Maxim CRC-8, with a zero
+# byte either side (see telemetry.c). Anything that isn't a valid frame
+# is console text, and goes to stderr.
+
+import argparse
+import fcntl
+import os
+import struct
+import sys
+import termios
+import time
+
+TELEMETRY_STATUS = 0x01
+PWM_BASE = 512
+
+# The rates the firmware's 'baud' setting accepts with the 12.288MHz
+# crystal. 76800 and 153600 have no Bxxx constant, and are set with
+# termios2/BOTHER (Linux only).
+BAUDS = {
+    9600: termios.B9600,
+    19200: termios.B19200,
+    38400: termios.B38400,
+    57600: termios.B57600,
+    76800: None,
+    153600: None,
+}
+
+# asm-generic/termbits.h and ioctls.h. struct termios2 is four flag
+# words, c_line, 19 control chars, then the input and output speeds
+TERMIOS2 = struct.Struct('=IIIIB19sII')
+TCGETS2 = 0x802C542A
+TCSETS2 = 0x402C542B
+CBAUD = 0o010017
+BOTHER = 0o010000
+
+
+def crc8(data):
+    crc = 0
+    for b in data:
+        for _ in range(8):
+            mix = (crc ^ b) & 0x01
+            crc >>= 1
+            if mix:
+                crc ^= 0x8C
+            b >>= 1
+    return crc
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data) + 1:
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def decode_status(payload):
+    slots = payload[2]
+    sensors = slots >> 4
+    fans = slots & 0x0F
+    fmt = '<BBBBB%dh%dH%dH' % (sensors, fans, fans)
+
+    if len(payload) != struct.calcsize(fmt):
+        return None
+
+    fields = struct.unpack(fmt, payload)
+    num_sensors, state = fields[3], fields[4]
+    temps = fields[5:5 + sensors]
+    rpms = fields[5 + sensors:5 + sensors + fans]
+    duties = fields[5 + sensors + fans:]
+
+    return {
+        'seq': fields[1],
+        'temps': [temps[i] / 10.0 if state & (1 << i) else None for i in range(min(num_sensors, sensors))],
+        'rpm': list(rpms),
+        'duty': [round(d * 100.0 / PWM_BASE, 1) for d in duties],
+    }
+
+
+def frames(stream):
+    buf = bytearray()
+    while True:
+        chunk = stream.read(64)
+        if not chunk:
+            return
+        for b in chunk:
+            if b != 0:
+                buf.append(b)
+                continue
+            if buf:
+                yield bytes(buf)
+            buf = bytearray()
+
+
+def open_port(path, baud):
+    fd = os.open(path, os.O_RDONLY | os.O_NOCTTY)
+    attr = termios.tcgetattr(fd)
+    attr[0] = 0                                     # iflag
+    attr[1] = 0                                     # oflag
+    attr[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attr[3] = 0                                     # lflag
+    attr[6][termios.VMIN] = 1
+    attr[6][termios.VTIME] = 0
+    attr[4] = attr[5] = BAUDS[baud] or termios.B38400
+    termios.tcsetattr(fd, termios.TCSANOW, attr)
+    if BAUDS[baud] is None:
+        set_custom_baud(fd, baud)
+    return os.fdopen(fd, 'rb', buffering=0)
+
+
+def set_custom_baud(fd, baud):
+    buf = bytearray(TERMIOS2.size)
+    fcntl.ioctl(fd, TCGETS2, buf)
+    iflag, oflag, cflag, lflag, line, cc, _, _ = TERMIOS2.unpack(buf)
+    cflag = (cflag & ~CBAUD) | BOTHER
+    fcntl.ioctl(fd, TCSETS2, TERMIOS2.pack(iflag, oflag, cflag, lflag, line, cc, baud, baud))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode fan controller telemetry')
+    parser.add_argument('port', help="serial port, or '-' for stdin")
+    parser.add_argument('-b', '--baud', type=int, default=9600, choices=sorted(BAUDS))
+    parser.add_argument('--csv', action='store_true', help='one CSV line per frame')
+    args = parser.parse_args()
+
+    stream = sys.stdin.buffer if args.port == '-' else open_port(args.port, args.baud)
+    last_seq = None
+    lost = 0
+
+    for raw in frames(stream):
+        payload = cobs_decode(raw)
+
+        if not payload or len(payload) < 4 or crc8(payload[:-1]) != payload[-1] or payload[0] != TELEMETRY_STATUS:
+            sys.stderr.write(raw.decode('ascii', 'replace'))
+            continue
+
+        status = decode_status(payload[:-1])
+
+        if status is None:
+            continue
+
+        if last_seq is not None:
+            lost += (status['seq'] - last_seq - 1) & 0xFF
+        last_seq = status['seq']
+
+        if args.csv:
+            cols = [time.time(), status['seq'], lost]
+            cols += ['' if t is None else t for t in status['temps']]
+            cols += status['rpm'] + status['duty']
+            print(','.join(str(c) for c in cols), flush=True)
+        else:
+            temps = ' '.join('--' if t is None else '%.1f' % t for t in status['temps'])
+            rpms = ' '.join(str(r) for r in status['rpm'])
+            duties = ' '.join('%.1f%%' % d for d in status['duty'])
+            print('seq %3u  temps %s  rpm %s  duty %s  lost %u' % (status['seq'], temps, rpms, duties, lost), flush=True)
+
+
+if __name__ == '__main__':
+    main()
@@ -24,12 +24,16 @@
 #include <stdbool.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
 
 #include "usart_buffered.h"
 #include "iopins.h"
+#include "timer.h"
 
-#define UART_TX_BUFFER_SIZE 64
-#define UART_RX_BUFFER_SIZE 256
+/* Big enough to take a whole status report without waiting. Console input is typed, so RX can be small */
+#define UART_TX_BUFFER_SIZE 256
+#define UART_RX_BUFFER_SIZE 64
 
 #ifdef _USART1_
 
@@ -44,6 +48,33 @@
 #error TX buffer size is not a power of 2
 #endif
 
+/*
+ * Rates offered for the console, with the divisor for normal (/16) and
+ * double speed (/8) mode worked out for F_CPU. usart1_set_baud() uses
+ * whichever is closer, if it's within USART_BAUD_TOLERANCE. 115200 and
+ * 230400 are left out as 12.288MHz can't get within it (2.6% and 4.8%).
+ */
+#define USART_BAUD_TOLERANCE 20      /* 1/1000. Both ends can be out, so half the ~4% a frame will take */
+
+#define usart_ubrr(baud, div) ((uint16_t)(((F_CPU) + (div) * (baud) / 2) / ((div) * (baud)) - 1))
+
+typedef struct {
+    uint32_t baud;
+    uint16_t ubrr;
+    uint16_t ubrr_u2x;
+} usart_baud_t;
+
+#define usart_baud(baud) { baud, usart_ubrr(baud, 16UL), usart_ubrr(baud, 8UL) }
+
+static const usart_baud_t _g_usart_bauds[] PROGMEM = {
+    usart_baud(9600UL),
+    usart_baud(19200UL),
+    usart_baud(38400UL),
+    usart_baud(57600UL),
+    usart_baud(76800UL),
+    usart_baud(153600UL),
+};
+
 static volatile uint8_t _g_usart_txbuf[UART_TX_BUFFER_SIZE];
 static volatile uint8_t _g_usart_rxbuf[UART_RX_BUFFER_SIZE];
 static volatile uint8_t _g_usart_txhead;
@@ -51,6 +82,10 @@ static volatile uint8_t _g_usart_txtail;
 static volatile uint8_t _g_usart_rxhead;
 static volatile uint8_t _g_usart_rxtail;
 static volatile uint8_t _g_usart_last_rx_error;
+static uint16_t _g_usart_tx_dropped;
+static volatile uint8_t _g_usart_rxgap[UART_RX_BUFFER_SIZE / 8];  /* Bit per RX byte. Set if it followed a gap */
+static volatile uint32_t _g_usart_rxstamp;                        /* Timer2, at the last byte */
+static uint16_t _g_usart_rxgap_counts;                            /* 0 if not timing bytes */
 
 ISR(USARTA_RX_vect)
 {
@@ -58,9 +93,18 @@ ISR(USARTA_RX_vect)
     uint8_t data;
     uint8_t usr;
     uint8_t lastRxError;
+    uint32_t stamp;
+    bool gap = false;
  
     usr  = UCSRAA;
     data = UDRA;
+
+    if (_g_usart_rxgap_counts)
+    {
+        stamp = timer2_stamp();
+        gap = ((stamp - _g_usart_rxstamp) & TIMER2_STAMP_MASK) >= _g_usart_rxgap_counts;
+        _g_usart_rxstamp = stamp;
+    }
     
     lastRxError = (usr & (_BV(FEA) | _BV(DORA)));
     tmphead = (_g_usart_rxhead + 1) & UART_RX_BUFFER_MASK;
@@ -73,6 +117,11 @@ ISR(USARTA_RX_vect)
     {
         _g_usart_rxhead = tmphead;
         _g_usart_rxbuf[tmphead] = data;
+
+        if (gap)
+            _g_usart_rxgap[tmphead >> 3] |= _BV(tmphead & 7);
+        else
+            _g_usart_rxgap[tmphead >> 3] &= ~_BV(tmphead & 7);
     }
 
     _g_usart_last_rx_error = lastRxError;   
@@ -127,6 +176,11 @@ void usart1_open(uint8_t flags, uint16_t brg)
             USART1_DDR &= ~_BV(USART1_XCK);
     }
 
+    if (flags & USART_BRGH)
+        UCSRAA |= _BV(U2XA);
+    else
+        UCSRAA &= ~_BV(U2XA);
+
     if (flags & USART_CONT_RX)
         UCSRAB |= _BV(RXENA);
     else
@@ -163,6 +217,44 @@ char usart1_get(void)
     return _g_usart_rxbuf[tmptail];
 }
 
+/*
+ * Mark received bytes that follow at least this many Timer2 counts of
+ * quiet, timed from the previous byte's interrupt. 0 stops timing them.
+ */
+void usart1_set_rx_gap(uint16_t counts)
+{
+    _g_usart_rxgap_counts = counts;
+}
+
+/*
+ * Whether the next byte usart1_get() will return followed a gap, or if
+ * nothing is waiting, whether there has been one since the last byte.
+ */
+bool usart1_rx_gap(void)
+{
+    uint8_t tmptail;
+    uint8_t intsave;
+    bool gap;
+
+    intsave = (SREG & _BV(SREG_I)) == _BV(SREG_I);
+    g_irq_disable();
+
+    if (_g_usart_rxhead != _g_usart_rxtail)
+    {
+        tmptail = (_g_usart_rxtail + 1) & UART_RX_BUFFER_MASK;
+        gap = (_g_usart_rxgap[tmptail >> 3] & _BV(tmptail & 7)) != 0;
+    }
+    else
+    {
+        gap = ((timer2_stamp() - _g_usart_rxstamp) & TIMER2_STAMP_MASK) >= _g_usart_rxgap_counts;
+    }
+
+    if (intsave)
+        g_irq_enable();
+
+    return gap;
+}
+
 void usart1_put(char c)
 {
     uint8_t tmphead = (_g_usart_txhead + 1) & UART_TX_BUFFER_MASK;
@@ -175,11 +267,107 @@ void usart1_put(char c)
     UCSRAB |= _BV(UDRIEA);
 }
 
+/* Drops the byte rather than waiting if the buffer is full */
+bool usart1_put_nowait(char c)
+{
+    uint8_t tmphead = (_g_usart_txhead + 1) & UART_TX_BUFFER_MASK;
+
+    if (tmphead == _g_usart_txtail)
+    {
+        if (_g_usart_tx_dropped != 0xFFFF)
+            _g_usart_tx_dropped++;
+
+        return false;
+    }
+
+    _g_usart_txbuf[tmphead] = c;
+    _g_usart_txhead = tmphead;
+
+    UCSRAB |= _BV(UDRIEA);
+
+    return true;
+}
+
+uint16_t usart1_tx_dropped(void)
+{
+    return _g_usart_tx_dropped;
+}
+
+/* Bytes that can be queued without waiting. Only grows until the caller puts more */
+uint8_t usart1_tx_free(void)
+{
+    return (_g_usart_txtail - _g_usart_txhead - 1) & UART_TX_BUFFER_MASK;
+}
+
+/* Until everything queued is on the wire */
 bool usart1_busy(void)
 {
     return (_g_usart_txhead != _g_usart_txtail || (UCSRAA & _BV(UDREA)) == 0);
 }
 
+/* Error of a divisor in 1/1000, either way */
+static uint16_t usart_baud_error(uint32_t baud, uint16_t ubrr, uint8_t div)
+{
+    uint32_t actual = F_CPU / ((uint32_t)div * (ubrr + 1));
+    uint32_t diff = actual > baud ? actual - baud : baud - actual;
+
+    return (diff * 1000) / baud;
+}
+
+/*
+ * Looks up a rate in the table and works out the best mode for it.
+ * Returns false if it isn't in the table or can't be made close enough.
+ */
+bool usart_baud_lookup(uint32_t baud, uint16_t *ubrr, bool *u2x)
+{
+    usart_baud_t entry;
+    uint16_t err;
+    uint16_t err_u2x;
+    uint8_t i;
+
+    for (i = 0; i < sizeof(_g_usart_bauds) / sizeof(_g_usart_bauds[0]); i++)
+    {
+        memcpy_P(&entry, &_g_usart_bauds[i], sizeof(entry));
+
+        if (entry.baud != baud)
+            continue;
+
+        err = usart_baud_error(baud, entry.ubrr, 16);
+        err_u2x = usart_baud_error(baud, entry.ubrr_u2x, 8);
+
+        /* Normal mode samples more times per bit, so it wins a tie */
+        *u2x = err_u2x < err;
+        *ubrr = *u2x ? entry.ubrr_u2x : entry.ubrr;
+
+        return (*u2x ? err_u2x : err) <= USART_BAUD_TOLERANCE;
+    }
+
+    return false;
+}
+
+/* Call with nothing left to send. Anything arriving during the switch is lost */
+bool usart1_set_baud(uint32_t baud)
+{
+    uint16_t ubrr;
+    bool u2x;
+
+    if (!usart_baud_lookup(baud, &ubrr, &u2x))
+        return false;
+
+    while (usart1_busy());
+    _delay_us(1100);                /* Last frame out of the shift register, at up to 9600 */
+
+    if (u2x)
+        UCSRAA |= _BV(U2XA);
+    else
+        UCSRAA &= ~_BV(U2XA);
+
+    UBRRAL = (ubrr & 0xFF);
+    UBRRAH = (ubrr >> 8);
+
+    return true;
+}
+
 uint8_t usart1_get_last_rx_error(void)
 {
     return _g_usart_last_rx_error;
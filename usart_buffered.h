@@ -36,8 +36,15 @@
 void usart1_open(uint8_t flags, uint16_t brg);
 bool usart1_busy(void);
 void usart1_put(char c);
+bool usart1_put_nowait(char c);
+uint16_t usart1_tx_dropped(void);
+uint8_t usart1_tx_free(void);
+bool usart1_set_baud(uint32_t baud);
+bool usart_baud_lookup(uint32_t baud, uint16_t *ubrr, bool *u2x);
 bool usart1_data_ready(void);
 char usart1_get(void);
+void usart1_set_rx_gap(uint16_t counts);
+bool usart1_rx_gap(void);
 uint8_t usart1_get_last_rx_error(void);
 
 #endif /* _USART1_ */
@@ -40,16 +40,25 @@ void reset(void)
     while (1);
 }
 
+static bool _g_print_mute;
+
+/* Only waits if the TX buffer is full */
 int print_char(char byte, FILE *stream)
 {
-    while (console_busy());
-    console_put(byte);
+    if (!_g_print_mute)
+        console_put(byte);
+
     return 0;
 }
 
+/* Drops printf() output, for when something else owns the console */
+void print_mute(bool mute)
+{
+    _g_print_mute = mute;
+}
+
 void putch(char byte)
 {
-    while (console_busy());
     console_put(byte);
 }
 
@@ -30,6 +30,7 @@ void eeprom_write_data(uint8_t addr, uint8_t *bytes, uint8_t len);
 char wdt_getch(void);
 void putch(char byte);
 int print_char(char byte, FILE *stream);
+void print_mute(bool mute);
 
 #undef printf
 #define printf(fmt, ...) printf_P(PSTR(fmt) __VA_OPT__(,) __VA_ARGS__)
@@ -38,6 +39,8 @@ int print_char(char byte, FILE *stream);
 #define strncmp_p(str, to, n) strncmp_P(str, PSTR(to), n)
 #define stricmp(str, to) strcasecmp_P(str, PSTR(to))
 #define delay_10ms(x) _delay_ms((x) * 10)
+#define stringify(x) _stringify(x)
+#define _stringify(x) #x
 
 #define I_1DP               0
 #define U_1DP               1